@@ -0,0 +1,75 @@
+/*
+ *  Tests the cost of inserting keys one at a time against inserting them as a batch.
+ *  Add 100000 to 2000000 keys to 1000000 servers, once with CuckooRings::insert on
+ *  each key and once with a single CuckooRings::insert_batch, and track the time,
+ *  the cost, the max load and the number of times a key moved between the rings.
+ * @author Ankit Gupta
+ * @author Jonah Kallenbach
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <assert.h>
+#include <stdlib.h>
+
+#include "cuckoorings.hpp"
+#include "perfcounters.hpp"
+
+using namespace std;
+
+int main ()
+{
+  // initialize variables and seed the random number generator
+  clock_t t1, t2;
+  srand (time(NULL));
+  PerfCounters perf;
+  int i, j;
+
+  // repeat the experiment several times
+  for (int repeat = 1; repeat < 4; ++repeat) {
+    for (j = 100000; j <= 2000000; j += 100000) {
+
+      // initialize the data structures
+      CuckooRings c((1L << 32), 500000);
+      CuckooRings b((1L << 32), 500000);
+      vector<int> keys;
+      for (i = 1; i <= j; ++i) {
+        keys.push_back(i);
+      }
+
+      // insert the keys one at a time
+      t1 = clock();
+      perf.start();
+      for (i = 1; i <= j; ++i) {
+        c.insert(i);
+      }
+      perf.stop();
+      t2 = clock();
+
+      // print statistics
+      cout << ((float)(t2-t1))/CLOCKS_PER_SEC << ",";
+      cout << ((float) c.cost_of_structure()) / c.getNumServers() << ",";
+      cout << c.get_max_load() << ",";
+      cout << c.key_moves() << endl;
+      perf.report("CuckooRings insert", j);
+
+      // insert the same keys as one batch
+      t1 = clock();
+      perf.start();
+      b.insert_batch(keys);
+      perf.stop();
+      t2 = clock();
+
+      // print statistics
+      cout << ((float)(t2-t1))/CLOCKS_PER_SEC << ",";
+      cout << ((float) b.cost_of_structure()) / b.getNumServers() << ",";
+      cout << b.get_max_load() << ",";
+      cout << b.key_moves() << endl;
+      perf.report("CuckooRings insert_batch", j);
+    }
+  }
+
+  return 0;
+}
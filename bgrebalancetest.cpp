@@ -0,0 +1,78 @@
+/*
+ *  Tests the latency of inserts with cuckooing done inline and in the background.
+ *  Add 1000000 keys to 100000 servers, where cascades are common, once with every
+ *  insert cascading inline and once with a background rebalancer moving at most
+ *  MOVES_PER_SEC keys a second. Track the p50, p99 and p999 latency of a single
+ *  insert, and the cost and max load once the background rebalancer has caught up.
+ *
+ *  Usage: bgrebalancetest [moves per second]
+ * @author Ankit Gupta
+ * @author Jonah Kallenbach
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <time.h>
+#include <assert.h>
+#include <stdlib.h>
+
+#include "cuckoorings.hpp"
+
+using namespace std;
+
+#define KEYS 1000000
+#define MOVES_PER_SEC 2000000
+
+int main (int argc, char** argv)
+{
+  // initialize variables and seed the random number generator
+  srand (time(NULL));
+  double rate = argc > 1 ? atof(argv[1]) : MOVES_PER_SEC;
+
+  for (int background = 0; background < 2; ++background) {
+    CuckooRings c((1L << 32), 50000);
+    if (background) {
+      c.start_rebalancer(rate);
+    }
+    vector<double> latencies;
+    latencies.reserve(KEYS);
+
+    auto start = chrono::steady_clock::now();
+    for (int i = 1; i <= KEYS; ++i) {
+      auto t = chrono::steady_clock::now();
+      c.insert(i);
+      latencies.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - t).count());
+    }
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    // give the background rebalancer time to catch up
+    auto caught = chrono::steady_clock::now();
+    while (c.rebalancer_pending() > 0) {
+      this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    double catch_up = chrono::duration<double>(chrono::steady_clock::now() - caught).count();
+    c.stop_rebalancer();
+    assert(c.getNumKeys() == KEYS);
+
+    sort(latencies.begin(), latencies.end());
+    cout << (background ? "Background rebalancer, " : "Inline cascades") ;
+    if (background) {
+      cout << rate << " moves/sec";
+    }
+    cout << endl;
+    cout << "    Insert time (sec): " << elapsed << endl;
+    cout << "    Insert latency p50/p99/p999/max (us): " << latencies[KEYS / 2] << "/"
+         << latencies[KEYS * 99 / 100] << "/" << latencies[KEYS * 999 / 1000] << "/"
+         << latencies.back() << endl;
+    cout << "    Catch-up time (sec): " << catch_up << endl;
+    cout << "    Cost: " << ((float) c.cost_of_structure()) / c.getNumServers() << endl;
+    cout << "    Max load: " << c.get_max_load() << endl;
+    cout << "    Key moves: " << c.key_moves() << endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,284 @@
+/** @class InlineBucket
+ * @brief The keys held by one server. Up to N keys are stored inline, so a
+ * server that stays near SERVER_THRESHOLD keeps its keys in the same one or
+ * two cache lines as its count. Past N the keys move to a heap chunk that
+ * grows like a std::vector.
+ *
+ * Each key also has an 8 bit fingerprint, packed in its own array. find
+ * compares 8 fingerprints at a time and only looks at the keys whose
+ * fingerprint matches, so a miss rarely reads a key at all.
+ *
+ * @author ankitvgupta
+ * @author jonahkall
+ */
+#ifndef BUCKET_HPP
+#define BUCKET_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+template <int N>
+class InlineBucket {
+private:
+  // fingerprints are scanned 8 at a time, so their arrays are padded to 8
+  static const unsigned FP_INLINE = (N + 7) / 8 * 8;
+
+  unsigned size_;
+  unsigned capacity_;
+
+  /**
+   * The overflow chunk, or NULL while the keys fit inline. It holds
+   * capacity_ keys followed by their padded fingerprints.
+   */
+  int* spill_;
+  int keys_[N];
+  unsigned char fps_[FP_INLINE];
+
+  int* data(void) {
+    return spill_ ? spill_ : keys_;
+  }
+
+  const int* data(void) const {
+    return spill_ ? spill_ : keys_;
+  }
+
+  unsigned char* fps(void) {
+    return spill_ ? (unsigned char*) (spill_ + capacity_) : fps_;
+  }
+
+  const unsigned char* fps(void) const {
+    return spill_ ? (const unsigned char*) (spill_ + capacity_) : fps_;
+  }
+
+  static int* allocate(unsigned capacity) {
+    unsigned fp_ints = (capacity + 7) / 8 * 2;
+    return new int[capacity + fp_ints];
+  }
+
+  void copy_from(const InlineBucket& other) {
+    size_ = other.size_;
+    if (other.size_ <= N) {
+      capacity_ = N;
+      spill_ = NULL;
+    }
+    else {
+      capacity_ = other.size_;
+      spill_ = allocate(capacity_);
+    }
+    memcpy(data(), other.data(), size_ * sizeof(int));
+    memcpy(fps(), other.fps(), size_);
+  }
+
+  void grow(void) {
+    unsigned capacity = capacity_ * 2;
+    int* spill = allocate(capacity);
+    memcpy(spill, data(), size_ * sizeof(int));
+    memcpy(spill + capacity, fps(), size_);
+    delete[] spill_;
+    spill_ = spill;
+    capacity_ = capacity;
+  }
+
+public:
+  typedef const int* iterator;
+  typedef const int* const_iterator;
+
+  /**
+   * @brief The fingerprint of a key, the top byte of a multiplicative hash
+   */
+  static unsigned char fingerprint(int key) {
+    return ((uint32_t) key * 0x9e3779b1u) >> 24;
+  }
+
+  InlineBucket() : size_(0), capacity_(N), spill_(NULL) {}
+
+  InlineBucket(const InlineBucket& other) {
+    copy_from(other);
+  }
+
+  InlineBucket(InlineBucket&& other) : size_(other.size_),
+      capacity_(other.capacity_), spill_(other.spill_) {
+    if (!spill_) {
+      memcpy(keys_, other.keys_, size_ * sizeof(int));
+      memcpy(fps_, other.fps_, size_);
+    }
+    other.spill_ = NULL;
+    other.size_ = 0;
+    other.capacity_ = N;
+  }
+
+  InlineBucket& operator=(const InlineBucket& other) {
+    if (this != &other) {
+      delete[] spill_;
+      copy_from(other);
+    }
+    return *this;
+  }
+
+  ~InlineBucket() {
+    delete[] spill_;
+  }
+
+  size_t size(void) const {
+    return size_;
+  }
+
+  bool empty(void) const {
+    return size_ == 0;
+  }
+
+  /**
+   * @brief The number of keys that fit before the bucket has to grow
+   */
+  size_t capacity(void) const {
+    return capacity_;
+  }
+
+  /**
+   * @brief The bytes of the overflow chunk, or 0 while the keys fit inline
+   */
+  size_t spill_bytes(void) const {
+    return spill_ ? (capacity_ + (capacity_ + 7) / 8 * 2) * sizeof(int) : 0;
+  }
+
+  /**
+   * @brief Whether the keys have spilled out of the inline array
+   */
+  bool spilled(void) const {
+    return spill_ != NULL;
+  }
+
+  iterator begin(void) const {
+    return data();
+  }
+
+  iterator end(void) const {
+    return data() + size_;
+  }
+
+  int operator[](size_t i) const {
+    return data()[i];
+  }
+
+  int back(void) const {
+    return data()[size_ - 1];
+  }
+
+  /**
+   * @brief Finds a key by its fingerprint
+   * @returns the index of the key, or -1 if it is not in the bucket
+   */
+  int find(int key) const {
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t highs = 0x8080808080808080ULL;
+    const uint64_t pattern = ones * fingerprint(key);
+    const unsigned char* f = fps();
+    const int* k = data();
+    for (unsigned i = 0; i < size_; i += 8) {
+      uint64_t word;
+      memcpy(&word, f + i, sizeof(word));
+      word ^= pattern;
+      // the high bit of every byte that is now zero is set
+      uint64_t match = (word - ones) & ~word & highs;
+      while (match) {
+        unsigned j = i + (__builtin_ctzll(match) >> 3);
+        if (j >= size_) {
+          break;
+        }
+        if (k[j] == key) {
+          return j;
+        }
+        match &= match - 1;
+      }
+    }
+    return -1;
+  }
+
+  /**
+   * @brief Determines whether a key is in the bucket
+   */
+  bool contains(int key) const {
+    return find(key) >= 0;
+  }
+
+  void push_back(int key) {
+    if (size_ == capacity_) {
+      grow();
+    }
+    data()[size_] = key;
+    fps()[size_] = fingerprint(key);
+    ++size_;
+  }
+
+  void pop_back(void) {
+    --size_;
+  }
+
+  /**
+   * @brief Replaces the key at index i
+   */
+  void set(size_t i, int key) {
+    data()[i] = key;
+    fps()[i] = fingerprint(key);
+  }
+
+  /**
+   * @brief Removes the key at it, keeping the rest in order
+   * @returns iterator to the key that followed it
+   */
+  iterator erase(iterator it) {
+    size_t i = it - data();
+    memmove(data() + i, data() + i + 1, (size_ - i - 1) * sizeof(int));
+    memmove(fps() + i, fps() + i + 1, size_ - i - 1);
+    --size_;
+    return data() + i;
+  }
+
+  /**
+   * @brief Removes a key, using its fingerprint to find it
+   * @returns whether the key was in the bucket
+   */
+  bool erase_key(int key) {
+    int i = find(key);
+    if (i < 0) {
+      return false;
+    }
+    erase(data() + i);
+    return true;
+  }
+
+  /**
+   * @brief Shrinks the bucket to its first n keys
+   */
+  void resize(size_t n) {
+    size_ = n;
+  }
+
+  /**
+   * @brief Removes every key. The overflow chunk is kept for reuse.
+   */
+  void clear(void) {
+    size_ = 0;
+  }
+
+  /**
+   * @brief Gives back overflow capacity the keys don't use. Keys that fit
+   *    inline move back inline, and the rest move to a chunk of their size.
+   */
+  void shrink_to_fit(void) {
+    if (!spill_ || capacity_ == size_) {
+      return;
+    }
+    int* spill = size_ <= N ? NULL : allocate(size_);
+    unsigned capacity = size_ <= N ? N : size_;
+    int* keys = spill ? spill : keys_;
+    unsigned char* prints = spill ? (unsigned char*) (spill + capacity) : fps_;
+    memcpy(keys, spill_, size_ * sizeof(int));
+    memcpy(prints, spill_ + capacity_, size_);
+    delete[] spill_;
+    spill_ = spill;
+    capacity_ = capacity;
+  }
+};
+
+#endif
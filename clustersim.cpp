@@ -0,0 +1,460 @@
+/*
+ *  Simulates what a membership change costs a real cluster.
+ *  Every server on the rings is a stand-in storage server holding VALUE_SIZE bytes per
+ *  key. The stand-ins are spread over NODES threads, each of which answers requests on
+ *  a pair of Unix sockets, one for clients and one for migration traffic. Keys are
+ *  routed by a RingHash or a CuckooRings, and every key the structure moves is copied
+ *  between stand-ins by a MigrationTracker.
+ *  Load KEYS keys, measure lookup latency, then remove CHANGE_SERVERS servers and add
+ *  CHANGE_SERVERS new ones. For each change, report the migration bytes sent over the
+ *  sockets, the latency of requests made while the copies are in flight, and the time
+ *  until every copy has committed.
+ * @author Ankit Gupta
+ * @author Jonah Kallenbach
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <time.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "cuckoorings.hpp"
+
+using namespace std;
+
+#define NODES 8
+#define SERVERS 20000
+#define KEYS 20000
+#define VALUE_SIZE 1024
+#define CHANGE_SERVERS 1000
+#define SAMPLES 20000
+
+enum Op { PUT, GET, TAKE, QUIT };
+
+/**
+ * A request to a stand-in. TAKE reads a key and deletes it, which is how a
+ * migration moves data off its old owner. PUT is followed by len bytes.
+ */
+struct Request {
+  uint32_t op;
+  uint32_t len;
+  int64_t server;
+  int64_t key;
+};
+
+/**
+ * The answer to a request. GET and TAKE are followed by len bytes when found.
+ */
+struct Reply {
+  uint32_t found;
+  uint32_t len;
+};
+
+/**
+ * Bytes written to and read from the migration sockets
+ */
+atomic<long long> migration_bytes(0);
+
+/**
+ * @brief Reports a failed system call and ends the simulation, since a
+ *    stand-in that can't talk to its peers would make every number wrong
+ */
+void fail(const char* what) {
+  perror(what);
+  exit(1);
+}
+
+void write_all(int fd, const void* buf, size_t len) {
+  const char* p = (const char*) buf;
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      fail("write");
+    }
+    p += n;
+    len -= n;
+  }
+}
+
+void read_all(int fd, void* buf, size_t len) {
+  char* p = (char*) buf;
+  while (len > 0) {
+    ssize_t n = read(fd, p, len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      fail("read");
+    }
+    if (n == 0) {
+      cerr << "read: connection closed" << endl;
+      exit(1);
+    }
+    p += n;
+    len -= n;
+  }
+}
+
+/** @class Node
+ * @brief A thread standing in for every storage server that hashes to it
+ */
+class Node {
+private:
+  // [0] is used by this node, [1] by the client or the migration worker
+  int client_[2];
+  int migration_[2];
+  unordered_map<int64_t, unordered_map<int64_t, string> > stores_;
+  thread thread_;
+
+  /**
+   * @returns false once the node has been told to quit
+   */
+  bool serve(int fd) {
+    Request req;
+    Reply rep;
+    read_all(fd, &req, sizeof(req));
+    if (req.op == QUIT) {
+      return false;
+    }
+    if (req.op == PUT) {
+      string value(req.len, '\0');
+      read_all(fd, &value[0], req.len);
+      stores_[req.server][req.key].swap(value);
+      rep.found = 1;
+      rep.len = 0;
+      write_all(fd, &rep, sizeof(rep));
+      return true;
+    }
+    auto& store = stores_[req.server];
+    auto it = store.find(req.key);
+    rep.found = it != store.end();
+    rep.len = rep.found ? it->second.size() : 0;
+    write_all(fd, &rep, sizeof(rep));
+    if (rep.found) {
+      write_all(fd, it->second.data(), rep.len);
+      if (req.op == TAKE) {
+        store.erase(it);
+      }
+    }
+    return true;
+  }
+
+  void run(void) {
+    struct pollfd fds[2];
+    fds[0].fd = client_[0];
+    fds[1].fd = migration_[0];
+    fds[0].events = fds[1].events = POLLIN;
+    for (;;) {
+      if (poll(fds, 2, -1) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        fail("poll");
+      }
+      for (int i = 0; i < 2; ++i) {
+        if ((fds[i].revents & POLLIN) && !serve(fds[i].fd)) {
+          return;
+        }
+      }
+    }
+  }
+
+  /**
+   * @brief Sends one request and waits for its reply
+   * @returns whether the key was found, with its value in out
+   */
+  bool call(int fd, uint32_t op, int64_t server, int64_t key,
+      const string* in, string* out, size_t* bytes) {
+    Request req;
+    Reply rep;
+    req.op = op;
+    req.server = server;
+    req.key = key;
+    req.len = in ? in->size() : 0;
+    write_all(fd, &req, sizeof(req));
+    if (in) {
+      write_all(fd, in->data(), in->size());
+    }
+    read_all(fd, &rep, sizeof(rep));
+    if (out && rep.found && rep.len > 0) {
+      out->resize(rep.len);
+      read_all(fd, &(*out)[0], rep.len);
+    }
+    *bytes += sizeof(req) + req.len + sizeof(rep) + rep.len;
+    return rep.found;
+  }
+
+public:
+  Node() {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, client_) != 0 ||
+        socketpair(AF_UNIX, SOCK_STREAM, 0, migration_) != 0) {
+      fail("socketpair");
+    }
+    thread_ = thread(&Node::run, this);
+  }
+
+  ~Node() {
+    Request req;
+    req.op = QUIT;
+    write_all(client_[1], &req, sizeof(req));
+    thread_.join();
+    close(client_[0]);
+    close(client_[1]);
+    close(migration_[0]);
+    close(migration_[1]);
+  }
+
+  void put(int64_t server, int64_t key, const string& value) {
+    size_t bytes = 0;
+    call(client_[1], PUT, server, key, &value, NULL, &bytes);
+  }
+
+  bool get(int64_t server, int64_t key, string* value) {
+    size_t bytes = 0;
+    return call(client_[1], GET, server, key, NULL, value, &bytes);
+  }
+
+  /**
+   * @brief Moves a key to another node over the migration sockets
+   * @returns false if this node no longer had the key
+   */
+  bool migrate(int64_t server, int64_t key, Node* to, int64_t to_server) {
+    size_t bytes = 0;
+    string value;
+    bool found = call(migration_[1], TAKE, server, key, NULL, &value, &bytes);
+    if (found) {
+      to->call(to->migration_[1], PUT, to_server, key, &value, NULL, &bytes);
+    }
+    migration_bytes += bytes;
+    return found;
+  }
+};
+
+vector<Node*> nodes;
+
+/**
+ * The stand-in server for a position on one side, so that servers on the
+ * two rings of a CuckooRings are kept apart
+ */
+int64_t stand_in(int side, long long server) {
+  return side ? -server - 1 : server;
+}
+
+Node* node_of(int64_t server) {
+  return nodes[hashstd(server, NODES)];
+}
+
+Placement route(RingHash& r, int key) {
+  Placement p;
+  p.side = 0;
+  p.server = r.lookup(key);
+  return p;
+}
+
+Placement route(CuckooRings& c, int key) {
+  return c.locate(key);
+}
+
+/**
+ * @brief Adds the servers in adds and removes those in removes
+ */
+void change(RingHash& r, const vector<long long>& adds, const vector<long long>& removes) {
+  r.apply_membership_changes(adds, removes);
+}
+
+/**
+ * @brief Splits the changes between the two sides of a CuckooRings
+ */
+void change(CuckooRings& c, const vector<long long>& adds, const vector<long long>& removes) {
+  size_t half_adds = adds.size() / 2, half_removes = removes.size() / 2;
+  c.apply_membership_changes(vector<long long>(adds.begin(), adds.begin() + half_adds),
+      vector<long long>(removes.begin(), removes.begin() + half_removes), 0);
+  c.apply_membership_changes(vector<long long>(adds.begin() + half_adds, adds.end()),
+      vector<long long>(removes.begin() + half_removes, removes.end()), 1);
+}
+
+vector<long long> pick_servers(RingHash& r, int n) {
+  vector<long long> out;
+  while ((int) out.size() < n) {
+    long long s = r.random_server();
+    if (find(out.begin(), out.end(), s) == out.end()) {
+      out.push_back(s);
+    }
+  }
+  return out;
+}
+
+vector<long long> pick_servers(CuckooRings& c, int n) {
+  vector<long long> out;
+  for (int side = 0; side < 2; ++side) {
+    size_t begin = out.size();
+    while (out.size() - begin < (size_t) (side ? n - n / 2 : n / 2)) {
+      long long s = c.random_server(side);
+      if (find(out.begin() + begin, out.end(), s) == out.end()) {
+        out.push_back(s);
+      }
+    }
+  }
+  return out;
+}
+
+/**
+ * @brief Reads a key from its owner. While the key is being migrated the
+ *    read falls back to the old owner, retrying until one of them has it.
+ * @returns the number of attempts it took, or 0 if the key was lost
+ */
+int read_key(Placement p, int key, MigrationTracker& tracker, string* value) {
+  Migration m;
+  for (int attempt = 1; attempt <= 1000; ++attempt) {
+    int64_t server = stand_in(p.side, p.server);
+    if (node_of(server)->get(server, key, value)) {
+      return attempt;
+    }
+    if (!tracker.in_flight(key, &m)) {
+      // the copy may have committed between the two checks
+      if (attempt > 1) {
+        return 0;
+      }
+      continue;
+    }
+    server = stand_in(m.from_side, m.from);
+    if (node_of(server)->get(server, key, value)) {
+      return attempt + 1;
+    }
+    this_thread::yield();
+  }
+  return 0;
+}
+
+double percentile(vector<double>& v, double q) {
+  if (v.empty()) {
+    return 0;
+  }
+  sort(v.begin(), v.end());
+  return v[min(v.size() - 1, (size_t) (q * v.size()))];
+}
+
+/**
+ * @brief Reads random keys until the tracker has nothing left in flight,
+ *    or for SAMPLES reads if wait is false
+ */
+template <typename Ring>
+void sample(const string& label, Ring& ring, MigrationTracker& tracker, bool wait) {
+  vector<double> latencies;
+  long long stalled = 0, lost = 0;
+  string value;
+  auto start = chrono::steady_clock::now();
+  while (wait ? tracker.num_pending() > 0 : (int) latencies.size() < SAMPLES) {
+    int key = rand() % KEYS + 1;
+    auto t1 = chrono::steady_clock::now();
+    int attempts = read_key(route(ring, key), key, tracker, &value);
+    auto t2 = chrono::steady_clock::now();
+    latencies.push_back(chrono::duration<double, micro>(t2 - t1).count());
+    stalled += attempts > 1;
+    lost += attempts == 0;
+  }
+  double elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+  cout << "    " << label << endl;
+  cout << "        Requests: " << latencies.size() << ", stalled: " << stalled
+       << ", lost: " << lost << endl;
+  cout << "        Latency p50/p99 (us): " << percentile(latencies, 0.5) << "/"
+       << percentile(latencies, 0.99) << endl;
+  if (wait) {
+    cout << "        Recovery time (ms): " << elapsed << endl;
+  }
+}
+
+template <typename Ring>
+void simulate(const string& name, Ring& ring) {
+  for (int i = 0; i < NODES; ++i) {
+    nodes.push_back(new Node());
+  }
+
+  // a single worker keeps the copies of each key in the order they were emitted
+  MigrationTracker tracker(KEYS, 1, [](const Migration& m) {
+    int64_t from = stand_in(m.from_side, m.from);
+    int64_t to = stand_in(m.to_side, m.to);
+    node_of(from)->migrate(from, m.key, node_of(to), to);
+  });
+  ring.set_migration_tracker(&tracker);
+
+  // load the keys, writing each to wherever it lands
+  string value(VALUE_SIZE, 'x');
+  for (int i = 1; i <= KEYS; ++i) {
+    ring.insert(i);
+    Placement p = route(ring, i);
+    int64_t server = stand_in(p.side, p.server);
+    node_of(server)->put(server, i, value);
+  }
+  tracker.wait_idle();
+
+  cout << name << endl;
+  sample("Steady state", ring, tracker, false);
+
+  // swap out some servers, first removing and then adding
+  vector<long long> removes = pick_servers(ring, CHANGE_SERVERS);
+  vector<long long> adds;
+  for (int i = 0; i < CHANGE_SERVERS; ++i) {
+    adds.push_back(((long long) rand() * RAND_MAX + rand()) % (1L << 32));
+  }
+  for (int step = 0; step < 2; ++step) {
+    migration_bytes = 0;
+    long long before = tracker.num_completed();
+    auto t1 = chrono::steady_clock::now();
+    if (step == 0) {
+      change(ring, vector<long long>(), removes);
+    }
+    else {
+      change(ring, adds, vector<long long>());
+    }
+    auto t2 = chrono::steady_clock::now();
+    sample(step == 0 ? "Removing servers" : "Adding servers", ring, tracker, true);
+    cout << "        Membership change (ms): "
+         << chrono::duration<double, milli>(t2 - t1).count() << endl;
+    cout << "        Keys migrated: " << tracker.num_completed() - before
+         << ", migration bytes: " << migration_bytes.load() << endl;
+  }
+
+  // every key should still be readable from exactly where it is routed
+  long long lost = 0;
+  for (int i = 1; i <= KEYS; ++i) {
+    Placement p = route(ring, i);
+    int64_t server = stand_in(p.side, p.server);
+    lost += !node_of(server)->get(server, i, &value);
+  }
+  cout << "    Keys lost: " << lost << endl;
+  ring.set_migration_tracker(NULL);
+
+  for (auto& n : nodes) {
+    delete n;
+  }
+  nodes.clear();
+}
+
+int main ()
+{
+  srand (time(NULL));
+
+  RingHash r((1L << 32), SERVERS);
+  simulate("RingHash", r);
+
+  CuckooRings c((1L << 32), SERVERS / 2);
+  simulate("CuckooRings", c);
+
+  return 0;
+}
@@ -0,0 +1,95 @@
+/*
+ *  Tests that a key removed through a WriteCombiner stays removed.
+ *  With BOUNDED_STALENESS the flusher thread merges buffers while writers insert and
+ *  remove. Run 64 threads on a RingHash with 10000 servers, each inserting its own
+ *  range of keys and removing each key right after it went in, so that the removed
+ *  key is often in a buffer the flusher is merging. Each merge is slowed down by
+ *  MERGE_DELAY_US so that merges and removes queue up for the ring together. Every
+ *  key is removed, so the ring should end up empty; a key the flusher merged after
+ *  its remove would be left behind. Then check that a read with FLUSH_ON_READ sees
+ *  every key inserted before it.
+ * @author Ankit Gupta
+ * @author Jonah Kallenbach
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <time.h>
+#include <assert.h>
+#include <stdlib.h>
+
+#include "ringhash.hpp"
+#include "writecombiner.hpp"
+
+using namespace std;
+
+#define KEYS_PER_THREAD 2000
+#define THREADS 64
+#define SERVERS 10000
+#define CAPACITY 4096
+#define MERGE_DELAY_US 20
+
+/**
+ * A RingHash whose merges take a while
+ */
+struct SlowRing {
+  RingHash& ring;
+
+  void insert_batch(const vector<int>& keys) {
+    ring.insert_batch(keys);
+    this_thread::sleep_for(chrono::microseconds(MERGE_DELAY_US));
+  }
+
+  void remove(int key) {
+    ring.remove(key);
+  }
+};
+
+int main ()
+{
+  // initialize variables and seed the random number generator
+  srand (time(NULL));
+
+  RingHash r((1L << 32), SERVERS);
+  {
+    SlowRing slow = {r};
+    WriteCombiner<SlowRing> combiner(slow, CAPACITY, BOUNDED_STALENESS, 2);
+    vector<thread> threads;
+    for (int t = 0; t < THREADS; ++t) {
+      threads.push_back(thread([&combiner, t] {
+        WriteCombiner<SlowRing>::Writer w = combiner.writer();
+        int base = t * KEYS_PER_THREAD + 1;
+        for (int k = base; k < base + KEYS_PER_THREAD; ++k) {
+          w.insert(k);
+          combiner.remove(k);
+        }
+      }));
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+  }
+  long long left = r.getNumKeys();
+  cout << "BOUNDED_STALENESS" << endl;
+  cout << "    Keys left after removing all " << THREADS * KEYS_PER_THREAD << ": " << left << endl;
+  assert(left == 0);
+
+  {
+    WriteCombiner<RingHash> combiner(r, CAPACITY, FLUSH_ON_READ);
+    WriteCombiner<RingHash>::Writer w = combiner.writer();
+    for (int k = 1; k <= KEYS_PER_THREAD; ++k) {
+      w.insert(k);
+      if (k % 97 == 0) {
+        assert(combiner.contains(k) && combiner.contains(k / 2 + 1));
+      }
+    }
+  }
+  assert(r.getNumKeys() == KEYS_PER_THREAD);
+  cout << "FLUSH_ON_READ" << endl;
+  cout << "    Every read saw the keys inserted before it" << endl;
+
+  return 0;
+}
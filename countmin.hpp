@@ -0,0 +1,163 @@
+/** @class CountMinSketch
+ * @brief Estimates how often each key has been accessed in a fixed amount of
+ * memory. Each of depth rows holds width counters, and a key counts in one
+ * counter per row; its estimate is the smallest of those counters, which is
+ * never below its true count. Counts are added by conservative update, only
+ * raising the counters that are at the minimum, which keeps the estimates of
+ * cold keys from drifting up with those of the hot keys they share counters
+ * with.
+ *
+ * So that a key that was hot once doesn't stay hot forever, every counter is
+ * halved after each window of accesses, and counts fade with an age of about
+ * one window.
+ *
+ * @author ankitvgupta
+ * @author jonahkall
+ */
+#ifndef COUNTMIN_HPP
+#define COUNTMIN_HPP
+
+#include <algorithm>
+#include <vector>
+#include <stdint.h>
+
+#include "farmhash.hpp"
+
+// The most rows a sketch can have
+#define SKETCH_MAX_DEPTH 8
+
+class CountMinSketch {
+private:
+  size_t width_;
+  unsigned depth_;
+  std::vector<uint32_t> counts_;
+
+  /**
+   * Accesses counted since the counters were last halved, the window that
+   * halves them, and the total of all accesses with the same aging
+   */
+  unsigned long long added_;
+  unsigned long long window_;
+  unsigned long long total_;
+
+  /**
+   * @brief Finds a key's counter in each row. The rows are picked by double
+   *    hashing one fingerprint, which is as good as a hash per row.
+   */
+  void cells(long long key, size_t* out) const {
+    uint64_t h = util::Fingerprint((uint64_t) key);
+    uint64_t step = (h >> 32) | (h << 32) | 1;
+    for (unsigned r = 0; r < depth_; ++r, h += step) {
+      out[r] = r * width_ + (size_t) (((unsigned __int128) h * width_) >> 64);
+    }
+  }
+
+  void halve(void) {
+    for (auto& c : counts_) {
+      c >>= 1;
+    }
+    total_ >>= 1;
+    added_ = 0;
+  }
+
+public:
+  /**
+   * Constructor for an empty CountMinSketch, which counts nothing
+   */
+  CountMinSketch() : width_(0), depth_(0), added_(0), window_(0), total_(0) {}
+
+  /**
+   * Constructor for a CountMinSketch. An estimate is off by at most
+   * e/width of all accesses with probability 1 - e^-depth.
+   * @param width the number of counters in each row
+   * @param depth the number of rows, at most SKETCH_MAX_DEPTH
+   * @param window the number of accesses after which every count is
+   *    halved, or 0 for 16 per counter in a row
+   */
+  CountMinSketch(size_t width, unsigned depth = 4, unsigned long long window = 0) :
+      width_(width ? width : 1), depth_(depth < 1 ? 1 : depth > SKETCH_MAX_DEPTH ? SKETCH_MAX_DEPTH : depth),
+      counts_(width_ * depth_, 0), added_(0), window_(window ? window : 16 * width_), total_(0) {}
+
+  /**
+   * @brief Whether the sketch has any counters at all
+   */
+  bool enabled(void) const {
+    return !counts_.empty();
+  }
+
+  /**
+   * @brief Counts accesses to a key
+   * @param n the number of accesses
+   * @returns the key's estimate afterwards
+   */
+  uint32_t add(long long key, uint32_t n = 1) {
+    size_t c[SKETCH_MAX_DEPTH] = { 0 };
+    cells(key, c);
+    uint32_t least = counts_[c[0]];
+    for (unsigned r = 1; r < depth_; ++r) {
+      least = counts_[c[r]] < least ? counts_[c[r]] : least;
+    }
+    uint32_t raised = least + n < least ? UINT32_MAX : least + n;
+    for (unsigned r = 0; r < depth_; ++r) {
+      if (counts_[c[r]] < raised) {
+        counts_[c[r]] = raised;
+      }
+    }
+    total_ += n;
+    added_ += n;
+    if (added_ >= window_) {
+      halve();
+      raised >>= 1;
+    }
+    return raised;
+  }
+
+  /**
+   * @brief the estimated number of accesses to a key, with aging
+   */
+  uint32_t estimate(long long key) const {
+    if (counts_.empty()) {
+      return 0;
+    }
+    size_t c[SKETCH_MAX_DEPTH] = { 0 };
+    cells(key, c);
+    uint32_t least = counts_[c[0]];
+    for (unsigned r = 1; r < depth_; ++r) {
+      least = counts_[c[r]] < least ? counts_[c[r]] : least;
+    }
+    return least;
+  }
+
+  /**
+   * @brief the number of accesses to every key, with the same aging as the
+   *    estimates
+   */
+  unsigned long long total(void) const {
+    return total_;
+  }
+
+  /**
+   * @brief the number of accesses after which every count is halved
+   */
+  unsigned long long window(void) const {
+    return window_;
+  }
+
+  /**
+   * @brief the memory the counters take, in bytes
+   */
+  size_t bytes(void) const {
+    return counts_.size() * sizeof(uint32_t);
+  }
+
+  /**
+   * @brief Forgets every access
+   */
+  void clear(void) {
+    std::fill(counts_.begin(), counts_.end(), 0);
+    added_ = 0;
+    total_ = 0;
+  }
+};
+
+#endif
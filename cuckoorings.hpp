@@ -6,24 +6,60 @@
  * @author ankitvgupta
  * @author jonahkall
  */
+#ifndef CUCKOORINGS_HPP
+#define CUCKOORINGS_HPP
+
 #include <iostream>
 #include <string>
 #include <set>
 #include <functional>
 #include <map>
 #include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <assert.h>
 
 #include "ringhash.hpp"
+#include "rebalancer.hpp"
+#include "countmin.hpp"
 #include "farmhash.hpp"
 
 #define STOP_ITERS 8
 
+// The most servers insert_batch looks at while relieving one overloaded server
+#define RELIEVE_LIMIT 1024
+
+// The most moves the background rebalancer saves up while it has nothing to
+// do, as a fraction of a second of its budget
+#define REBALANCE_BURST 0.01
+
+// A key is hot once its share of the recent accesses is at least HOT_FRACTION
+// and it has been accessed at least HOT_MIN_ACCESSES times. At most HOT_KEYS
+// keys are hot at once.
+#define HOT_FRACTION 0.001
+#define HOT_MIN_ACCESSES 32
+#define HOT_KEYS 128
+
+/**
+ * A server in a CuckooRings, given by its side (0 for left, 1 for right)
+ * and its server_id within that ring
+ */
+struct Placement {
+  int side;
+  long long server;
+};
+
 class CuckooRings {
 private:
   typedef long long server_id;
-  typedef std::map<long long, std::vector<int> > MapType;
-  typedef MapType::iterator MapIterator;
-  typedef std::vector<int>::iterator VectorIterator;
+  typedef RingHash::Bucket Bucket;
+  typedef RingHash::MapIterator MapIterator;
 
   /**
    * Key space size. Indicates what the maximum key to be hashed to is
@@ -43,24 +79,460 @@ private:
 
   unsigned insert_counter;
 
+  /**
+   * The number of times a stored key has moved between the rings
+   */
+  long long key_moves_;
+
+  /**
+   * Cuckoo cascades started, servers emptied into the other ring by them,
+   * servers left overloaded because a cascade hit STOP_ITERS, and the most
+   * servers any one cascade emptied
+   */
+  long long cascades_;
+  long long cascade_steps_;
+  long long cascades_cut_;
+  unsigned cascade_longest_;
+
+  /**
+   * When set, keys cuckooed between the rings are reported here
+   */
+  MigrationTracker* migrations_;
+
+  /**
+   * An optional cache of where keys sit. It is tagged with the sum of the two
+   * rings' generations, and keys are dropped one at a time as they move.
+   */
+  LookupCache<Placement> cache_;
+
+  /**
+   * An optional sketch of how often each key is inserted or looked up. Hot
+   * keys are served from both of their servers, and each keeps its two
+   * servers. hot_by_server_ lists the hot keys of each server, keyed by
+   * server_id << 1 | side, so a server's weight doesn't look at every hot
+   * key. Both are found again when generation() moves past hot_generation_.
+   */
+  struct Hot {
+    server_id left;
+    server_id right;
+  };
+  CountMinSketch sketch_;
+  double hot_fraction_;
+  std::unordered_map<int, Hot> hot_;
+  std::unordered_map<unsigned long long, std::vector<int> > hot_by_server_;
+  unsigned long long hot_generation_;
+
+  /**
+   * The state of the background rebalancer, which exists only while it runs.
+   * Overloaded servers wait in pending, once each, until the worker gets to
+   * them, and every public method holds the lock while it is on. The pointer
+   * is atomic because the worker reads it while the owner, the thread that
+   * started it, is the only one that sets it.
+   */
+  struct Background {
+    std::recursive_mutex lock;
+    std::condition_variable_any wake;
+    std::deque<std::pair<int, server_id> > pending;
+    std::unordered_set<unsigned long long> queued;
+    double moves_per_sec;
+    bool stopping;
+    long long moves;
+    std::thread worker;
+    std::thread::id owner;
+  };
+  std::atomic<Background*> background_;
+
+  /**
+   * @brief Takes the background rebalancer's lock if it is running
+   */
+  std::unique_lock<std::recursive_mutex> guard(void) {
+    Background* b = background_;
+    return b ? std::unique_lock<std::recursive_mutex>(b->lock) :
+        std::unique_lock<std::recursive_mutex>();
+  }
+
+  /**
+   * @brief Leaves an overloaded server for the background rebalancer
+   */
+  void defer(int side, server_id s) {
+    Background& b = *background_;
+    if (b.queued.insert(((unsigned long long) s << 1) | side).second) {
+      b.pending.push_back(std::make_pair(side, s));
+      b.wake.notify_one();
+    }
+  }
+
+  /**
+   * @brief Cuckoos the servers that keys moving off of dead servers, on a
+   *    lookup or a sweep, pushed over SERVER_THRESHOLD, or leaves them to
+   *    the background rebalancer if it is running
+   * @returns whether there were any
+   */
+  bool settle_overflow(void) {
+    bool any = false;
+    RingHash* rings[2] = { left_ring_, right_ring_ };
+    for (int side = 0; side < 2; ++side) {
+      std::vector<server_id> over;
+      over.swap(rings[side]->overflow_);
+      for (const auto& s : over) {
+        MapIterator m = rings[side]->cache_indices_.find(s);
+        if (m == rings[side]->cache_indices_.end() || m->second.size() <= SERVER_THRESHOLD) {
+          continue;
+        }
+        any = true;
+        if (background_) {
+          defer(side, s);
+          continue;
+        }
+        insert_counter = 0;
+        ++cascades_;
+        if (side == 0) {
+          send_server_ltor(s);
+        }
+        else {
+          send_server_rtol(s);
+        }
+      }
+    }
+    return any;
+  }
+
+  /**
+   * @brief Finds where a key sits, or would be inserted, as locate does,
+   *    without the cache or the hot key counts
+   * @param found set to whether the key is stored
+   * @param at if given, set to the key's server on each ring. The right
+   *    one is only looked for if the key is not on the left, and is the
+   *    right ring's end otherwise.
+   */
+  Placement place(int key, bool* found, MapIterator* at = NULL) {
+    Placement p;
+    p.side = 0;
+    MapIterator l = left_ring_->find_server(key);
+    p.server = l->first;
+    *found = l->second.contains(key);
+    if (at) {
+      at[0] = l;
+      at[1] = right_ring_->cache_indices_.end();
+    }
+    if (!*found) {
+      MapIterator r = right_ring_->find_server(key);
+      if (at) {
+        at[1] = r;
+      }
+      *found = r->second.contains(key);
+      if (*found || (sketch_.enabled() ? prefer_right(l, r) :
+          left_ring_->num_keys() > right_ring_->num_keys())) {
+        p.side = 1;
+        p.server = r->first;
+      }
+    }
+    return p;
+  }
+
+  /**
+   * @brief The background rebalancer. It relieves one pending server at a
+   *    time by the same shortest chains as insert_batch, spends a token per
+   *    key moved from a bucket refilled at moves_per_sec, and lets go of the
+   *    lock between servers so foreground calls get in.
+   */
+  void rebalance_in_background(void) {
+    Background& b = *background_;
+    double tokens = 0;
+    std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+    std::unique_lock<std::recursive_mutex> lock(b.lock);
+    while (!b.stopping) {
+      if (b.pending.empty()) {
+        b.wake.wait(lock);
+        last = std::chrono::steady_clock::now();
+        continue;
+      }
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      tokens = std::min(std::max(1.0, b.moves_per_sec * REBALANCE_BURST),
+          tokens + b.moves_per_sec * std::chrono::duration<double>(now - last).count());
+      last = now;
+      if (tokens < 1) {
+        b.wake.wait_for(lock, std::chrono::duration<double>((1 - tokens) / b.moves_per_sec));
+        continue;
+      }
+
+      std::pair<int, server_id> p = b.pending.front();
+      b.pending.pop_front();
+      b.queued.erase(((unsigned long long) p.second << 1) | p.first);
+      RingHash* ring = p.first ? right_ring_ : left_ring_;
+      MapIterator s = ring->cache_indices_.find(p.second);
+      if (s != ring->cache_indices_.end() && ring->dead_.find(p.second) == ring->dead_.end() &&
+          s->second.size() > SERVER_THRESHOLD) {
+        long long before = key_moves_;
+        // a server with no chain to room now is dropped, as in insert_batch
+        if (relieve(p.first, s) && s->second.size() > SERVER_THRESHOLD) {
+          defer(p.first, p.second);
+        }
+        tokens -= key_moves_ - before;
+        b.moves += key_moves_ - before;
+      }
+      lock.unlock();
+      std::this_thread::yield();
+      lock.lock();
+    }
+  }
+
+  /**
+   * @brief Moves a key from one of its servers to the other
+   */
+  void move_key(int key, int from_side, MapIterator from, MapIterator to) {
+    RingHash* src = from_side ? right_ring_ : left_ring_;
+    RingHash* dst = from_side ? left_ring_ : right_ring_;
+    src->remove_at(from, key);
+    dst->insert_at(to, key);
+    ++key_moves_;
+    if (migrations_) {
+      migrations_->emit(key, from_side, from->first, 1 - from_side, to->first);
+    }
+    if (cache_.enabled()) {
+      cache_.invalidate(key);
+    }
+  }
+
+  /**
+   * @brief the fewest accesses that make a key hot now
+   */
+  double hot_threshold(void) const {
+    return std::max((double) HOT_MIN_ACCESSES, hot_fraction_ * sketch_.total());
+  }
+
+  /**
+   * @brief Counts an access to a key, and makes it hot if it has become
+   *    hot enough. When the sketch ages, keys that have cooled to half of
+   *    the threshold stop being hot.
+   */
+  void touch(int key) {
+    unsigned long long before = sketch_.total();
+    double estimate = sketch_.add(key);
+    if (sketch_.total() < before) {
+      std::vector<int> cooled;
+      for (const auto& h : hot_) {
+        if (sketch_.estimate(h.first) < hot_threshold() / 2) {
+          cooled.push_back(h.first);
+        }
+      }
+      for (const auto& k : cooled) {
+        drop_hot(k);
+      }
+    }
+    if (estimate < hot_threshold() || hot_.find(key) != hot_.end()) {
+      return;
+    }
+    if (hot_.size() >= HOT_KEYS) {
+      // make room by dropping the coldest hot key, if it is colder than this one
+      auto coldest = hot_.begin();
+      for (auto h = hot_.begin(); h != hot_.end(); ++h) {
+        if (sketch_.estimate(h->first) < sketch_.estimate(coldest->first)) {
+          coldest = h;
+        }
+      }
+      if (sketch_.estimate(coldest->first) >= estimate) {
+        return;
+      }
+      drop_hot(coldest->first);
+    }
+    refresh_hot();
+    Hot h = { (server_id) left_ring_->find_server(key)->first,
+        (server_id) right_ring_->find_server(key)->first };
+    hot_[key] = h;
+    hot_by_server_[((unsigned long long) h.left << 1) | 0].push_back(key);
+    hot_by_server_[((unsigned long long) h.right << 1) | 1].push_back(key);
+  }
+
+  /**
+   * @brief Stops treating a key as hot
+   */
+  void drop_hot(int key) {
+    auto h = hot_.find(key);
+    if (h == hot_.end()) {
+      return;
+    }
+    unsigned long long servers[2] = { ((unsigned long long) h->second.left << 1) | 0,
+        ((unsigned long long) h->second.right << 1) | 1 };
+    for (int side = 0; side < 2; ++side) {
+      auto list = hot_by_server_.find(servers[side]);
+      if (list == hot_by_server_.end()) {
+        continue;
+      }
+      list->second.erase(std::find(list->second.begin(), list->second.end(), key));
+      if (list->second.empty()) {
+        hot_by_server_.erase(list);
+      }
+    }
+    hot_.erase(h);
+  }
+
+  /**
+   * @brief Finds the two servers of every hot key again if either ring's
+   *    membership has changed since they were last found
+   */
+  void refresh_hot(void) {
+    if (hot_generation_ == generation()) {
+      return;
+    }
+    hot_by_server_.clear();
+    for (auto& h : hot_) {
+      h.second.left = left_ring_->find_server(h.first)->first;
+      h.second.right = right_ring_->find_server(h.first)->first;
+      hot_by_server_[((unsigned long long) h.second.left << 1) | 0].push_back(h.first);
+      hot_by_server_[((unsigned long long) h.second.right << 1) | 1].push_back(h.first);
+    }
+    hot_generation_ = generation();
+  }
+
+  /**
+   * @brief The weight a stored key adds to the server that holds it: one
+   *    for being stored plus its recent accesses, of which a hot key only
+   *    brings half, since the other half is served by its other server
+   */
+  long long key_weight(int key) const {
+    long long accesses = sketch_.estimate(key);
+    return 1 + (hot_.find(key) != hot_.end() ? accesses / 2 : accesses);
+  }
+
+  /**
+   * @brief The load of a server by weight: the weights of its keys, plus
+   *    half the accesses of each hot key whose other server it is
+   */
+  long long server_weight(int side, MapIterator s) {
+    long long weight = 0;
+    for (const auto& key : s->second) {
+      weight += key_weight(key);
+    }
+    if (hot_.empty()) {
+      return weight;
+    }
+    refresh_hot();
+    auto list = hot_by_server_.find(((unsigned long long) s->first << 1) | side);
+    if (list != hot_by_server_.end()) {
+      for (const auto& key : list->second) {
+        if (!s->second.contains(key)) {
+          weight += sketch_.estimate(key) / 2;
+        }
+      }
+    }
+    return weight;
+  }
+
+  /**
+   * @brief Whether a new key belongs on its right ring server rather than
+   *    its left one: the lighter of the two by weight when hot keys are
+   *    tracked, and otherwise the one with fewer keys
+   */
+  bool prefer_right(MapIterator l, MapIterator r) {
+    if (sketch_.enabled()) {
+      long long lw = server_weight(0, l), rw = server_weight(1, r);
+      if (lw != rw) {
+        return rw < lw;
+      }
+    }
+    return r->second.size() < l->second.size();
+  }
+
+  /**
+   * @brief Takes one key off of an overloaded server by a breadth-first
+   *    search of the two-choice graph: each key is an edge between its two
+   *    servers. The shortest chain of keys, each moving to its other server,
+   *    that ends at a server with room is moved, so every server on the
+   *    chain but the first and last keeps its load.
+   * @returns false if there is no such chain of at most STOP_ITERS keys
+   */
+  bool relieve(int side, MapIterator s) {
+    struct Step {
+      int side;
+      MapIterator server;
+      int parent;
+      int key;
+      unsigned depth;
+    };
+    std::vector<Step> steps;
+    std::unordered_set<unsigned long long> seen;
+    Step root = { side, s, -1, 0, 0 };
+    steps.push_back(root);
+    seen.insert(((unsigned long long) s->first << 1) | side);
+    for (size_t head = 0; head < steps.size() && steps.size() < RELIEVE_LIMIT; ++head) {
+      Step cur = steps[head];
+      if (cur.depth >= STOP_ITERS) {
+        continue;
+      }
+      RingHash* other = cur.side ? left_ring_ : right_ring_;
+      for (const auto& key : cur.server->second) {
+        MapIterator alt = other->find_server(key);
+        if (!seen.insert(((unsigned long long) alt->first << 1) | (1 - cur.side)).second) {
+          continue;
+        }
+        Step next = { 1 - cur.side, alt, (int) head, key, cur.depth + 1 };
+        steps.push_back(next);
+        if (alt->second.size() < SERVER_THRESHOLD) {
+          // shift the chain along, starting from the end with room
+          for (int i = steps.size() - 1; steps[i].parent >= 0; i = steps[i].parent) {
+            const Step& from = steps[steps[i].parent];
+            move_key(steps[i].key, from.side, from.server, steps[i].server);
+          }
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  /**
+   * @brief Loads every stored key into a Rebalancer. The live servers of the
+   *    left ring come first, then those of the right ring. A key still on a
+   *    dead server is counted on the live server a sweep would give it to.
+   * @param keys filled with the keys, in the order they were added
+   * @returns false if either ring has no live server
+   */
+  bool build_rebalancer(Rebalancer& rb, std::vector<int>& keys) {
+    std::vector<long long> pos[2];
+    RingHash* rings[2] = { left_ring_, right_ring_ };
+    for (int side = 0; side < 2; ++side) {
+      for (const auto& x : rings[side]->cache_indices_) {
+        if (rings[side]->dead_.find(x.first) == rings[side]->dead_.end()) {
+          pos[side].push_back(x.first);
+        }
+      }
+      if (pos[side].empty()) {
+        return false;
+      }
+    }
+    rb.reset(pos[0].size() + pos[1].size());
+    keys.clear();
+    for (int side = 0; side < 2; ++side) {
+      for (const auto& x : rings[side]->cache_indices_) {
+        for (const auto& key : x.second) {
+          int ends[2];
+          for (int r = 0; r < 2; ++r) {
+            long long h = rings[r]->hash(key, kss_);
+            size_t i = std::lower_bound(pos[r].begin(), pos[r].end(), h) - pos[r].begin();
+            ends[r] = (i == pos[r].size() ? 0 : i) + (r ? pos[0].size() : 0);
+          }
+          keys.push_back(key);
+          rb.add_key(ends[0], ends[1], side);
+        }
+      }
+    }
+    return true;
+  }
+
 public:
+  friend class VersionedCuckooRings;
 
   /*
    * @brief THis is the hash function to be used by left HashRing
    * @param a the number that being hashed
    * @param kss_ the key space size
    * @returns a hash between 0 and kss_
-   * Source: Thomas Wang, http://burtleburtle.net/bob/hash/integer.html
+   * Source: Austin Appleby, https://github.com/aappleby/smhasher (fmix64)
    */
   static
   long long hash_left(long long a, long long kss_) {
-    a = (a+0x7ed55d16) + (a<<12);
-    a = (a^0xc761c23c) ^ (a>>19);
-    a = (a+0x165667b1) + (a<<5);
-    a = (a+0xd3a2646c) ^ (a<<9);
-    a = (a+0xfd7046c5) + (a<<3);
-    a = (a^0xb55a4f09) ^ (a>>16);
-    return abs(((a % kss_) + kss_) % kss_);
+    return hashstd(a, kss_);
   }
 
   /*
@@ -71,17 +543,9 @@ public:
    * Source: Thomas Wang via Geoffrey Irving, https://naml.us/blog/tag/thomas-wang
    */
   static
-  long long hash_right(long long key, long long kss_) {
-  key = (~key) + (key << 21); // key = (key << 21) - key - 1;
-  key = key ^ (key >> 24);
-  key = (key + (key << 3)) + (key << 8); // key * 265
-  key = key ^ (key >> 14);
-  key = (key + (key << 2)) + (key << 4); // key * 21
-  key = key ^ (key >> 28);
-  key = key + (key << 31);
-  
-  return abs(((key % kss_) + kss_) % kss_);
-}
+  long long hash_right(long long a, long long kss_) {
+    return hash_wang64(a, kss_);
+  }
 
 
   /**
@@ -94,7 +558,86 @@ public:
     // Set up keyspace now
     left_ring_ = new RingHash(key_space_size, init_servers, hash_left);
     right_ring_ = new RingHash(key_space_size, init_servers, hash_right);
+    left_ring_->collect_overflow_ = true;
+    right_ring_->collect_overflow_ = true;
     num_servers_ = 2 * init_servers;
+    migrations_ = NULL;
+    key_moves_ = 0;
+    cascades_ = 0;
+    cascade_steps_ = 0;
+    cascades_cut_ = 0;
+    cascade_longest_ = 0;
+    background_ = NULL;
+    hot_fraction_ = HOT_FRACTION;
+    hot_generation_ = 0;
+  }
+
+  /**
+   * Destructor, stops the background rebalancer if it is running and frees
+   * both rings
+   */
+  ~CuckooRings() {
+    stop_rebalancer();
+    delete left_ring_;
+    delete right_ring_;
+  }
+
+  // the rings are owned, so a copy would free them twice
+  CuckooRings(const CuckooRings&) = delete;
+  CuckooRings& operator=(const CuckooRings&) = delete;
+
+  /**
+   * @brief Starts a thread that relieves overloaded servers in the
+   *    background. From then on insert only places the key and leaves any
+   *    server it overloads to the thread, as do membership changes and
+   *    insert_batch, and every public method takes a lock, so the rings may
+   *    be used from several threads. The lock only exists while the thread
+   *    runs, so start_rebalancer and stop_rebalancer must be called while no
+   *    other thread is using the rings, and from the same thread.
+   * @param moves_per_sec the most keys the thread moves per second
+   */
+  void start_rebalancer(double moves_per_sec) {
+    if (background_ || moves_per_sec <= 0) {
+      return;
+    }
+    Background* b = new Background();
+    b->moves_per_sec = moves_per_sec;
+    b->stopping = false;
+    b->moves = 0;
+    b->owner = std::this_thread::get_id();
+    // published before the worker starts, which reads it
+    background_ = b;
+    b->worker = std::thread(&CuckooRings::rebalance_in_background, this);
+  }
+
+  /**
+   * @brief Stops the background rebalancer. Servers it had not got to yet
+   *    stay overloaded; inserts cascade inline again from now on.
+   */
+  void stop_rebalancer(void) {
+    Background* b = background_;
+    if (!b) {
+      return;
+    }
+    assert(std::this_thread::get_id() == b->owner);
+    {
+      std::unique_lock<std::recursive_mutex> lock(b->lock);
+      b->stopping = true;
+      b->wake.notify_one();
+    }
+    b->worker.join();
+    background_ = NULL;
+    delete b;
+  }
+
+  /**
+   * @brief the number of overloaded servers waiting for the background
+   *    rebalancer, or 0 if it is not running
+   */
+  size_t rebalancer_pending(void) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    Background* b = background_;
+    return b ? b->pending.size() : 0;
   }
 
   /**
@@ -102,22 +645,180 @@ public:
    * @brief Inserts a key into the HashRing
    */
   void insert (int key) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
     insert_counter = 0;
     server_id ret;
-    if (left_ring_->num_keys() > right_ring_->num_keys()) {
-      ret = right_ring_->insert(key);
-      if (ret != -1) {
+    MapIterator l = left_ring_->find_server(key);
+    MapIterator r = right_ring_->find_server(key);
+
+    if (sketch_.enabled()) {
+      touch(key);
+    }
+    // a key that is already stored on either side is not stored again
+    if (l->second.contains(key) || r->second.contains(key)) {
+      return;
+    }
+    if (sketch_.enabled() ? prefer_right(l, r) : left_ring_->num_keys() > right_ring_->num_keys()) {
+      ret = right_ring_->insert_at(r, key);
+      if (ret != -1 && background_) {
+        defer(1, ret);
+      }
+      else if (ret != -1) {
+        ++cascades_;
         send_server_rtol(ret);
       }
     }
     else {
-      ret = left_ring_->insert(key);
-      if (ret != -1) {
+      ret = left_ring_->insert_at(l, key);
+      if (ret != -1 && background_) {
+        defer(0, ret);
+      }
+      else if (ret != -1) {
+        ++cascades_;
         send_server_ltor(ret);
       }
     }
   }
 
+  /**
+   * @brief Inserts many keys at once. Every key first goes to the emptier of
+   *    its two servers with no cuckooing at all. Then each server left over
+   *    SERVER_THRESHOLD is relieved one key at a time along the shortest
+   *    chain of moves that ends at a server with room, so only the keys on
+   *    those chains move, instead of whole servers. While the background
+   *    rebalancer runs, those servers are left to it instead.
+   * @param keys the keys to insert; keys already stored are skipped
+   */
+  void insert_batch(const std::vector<int>& keys) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    // finding a server can erase a dead one, which would invalidate the
+    // servers already found for other keys
+    if (!left_ring_->dead_.empty() || !right_ring_->dead_.empty()) {
+      for (const auto& key : keys) {
+        insert(key);
+      }
+      return;
+    }
+    struct Pending {
+      long long pos;
+      int key;
+      MapIterator l;
+      MapIterator r;
+    };
+    std::vector<Pending> pending(keys.size());
+
+    // find every key's servers one ring at a time, in ring order, so that
+    // each search starts near where the last one ended up in cache
+    for (int side = 0; side < 2; ++side) {
+      RingHash* ring = side ? right_ring_ : left_ring_;
+      for (size_t i = 0; i < keys.size(); ++i) {
+        pending[i].key = side ? pending[i].key : keys[i];
+        pending[i].pos = ring->hash(pending[i].key, kss_);
+      }
+      std::sort(pending.begin(), pending.end(),
+          [](const Pending& a, const Pending& b) { return a.pos < b.pos; });
+      for (auto& p : pending) {
+        (side ? p.r : p.l) = ring->find_server(p.key);
+      }
+    }
+
+    std::vector<std::pair<int, MapIterator> > over;
+    for (const auto& p : pending) {
+      if (p.l->second.contains(p.key) || p.r->second.contains(p.key)) {
+        continue;
+      }
+      if (sketch_.enabled()) {
+        touch(p.key);
+      }
+      if (prefer_right(p.l, p.r)) {
+        if (right_ring_->insert_at(p.r, p.key) != -1) {
+          over.push_back(std::make_pair(1, p.r));
+        }
+      }
+      else if (left_ring_->insert_at(p.l, p.key) != -1) {
+        over.push_back(std::make_pair(0, p.l));
+      }
+    }
+
+    // one pass over every server that overflowed. A server that can't be
+    // relieved now won't be later in the pass either, so each is tried once.
+    std::unordered_set<unsigned long long> tried;
+    for (const auto& o : over) {
+      if (!tried.insert(((unsigned long long) o.second->first << 1) | o.first).second) {
+        continue;
+      }
+      if (background_) {
+        defer(o.first, o.second->first);
+        continue;
+      }
+      while (o.second->second.size() > SERVER_THRESHOLD && relieve(o.first, o.second)) {
+      }
+    }
+  }
+
+  /**
+   * @brief Moves keys between the rings so that the placement has the lowest
+   *    possible cost_of_structure and max load for the keys stored now.
+   *    Keys on dead servers are swept first. Only the keys whose side
+   *    changes move.
+   * @returns the number of keys moved
+   */
+  long long rebalance_optimal(void) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    sweep(LLONG_MAX);
+    Rebalancer rb;
+    std::vector<int> keys;
+    if (!build_rebalancer(rb, keys)) {
+      return 0;
+    }
+    std::vector<char> before(keys.size());
+    for (size_t k = 0; k < keys.size(); ++k) {
+      before[k] = rb.side(k);
+    }
+    rb.solve();
+    long long moved = 0;
+    for (size_t k = 0; k < keys.size(); ++k) {
+      if (rb.side(k) == before[k]) {
+        continue;
+      }
+      MapIterator l = left_ring_->find_server(keys[k]);
+      MapIterator r = right_ring_->find_server(keys[k]);
+      if (before[k]) {
+        move_key(keys[k], 1, r, l);
+      }
+      else {
+        move_key(keys[k], 0, l, r);
+      }
+      ++moved;
+    }
+    return moved;
+  }
+
+  /**
+   * @brief the lowest cost_of_structure any placement of the stored keys
+   *    could have, as if keys on dead servers had been swept. Nothing moves.
+   */
+  long long optimal_cost(void) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    Rebalancer rb;
+    std::vector<int> keys;
+    if (!build_rebalancer(rb, keys)) {
+      return cost_of_structure();
+    }
+    rb.solve();
+    long long cost = rb.cost();
+    return cost;
+  }
+
+  /**
+   * @brief the number of times a stored key has moved between the rings,
+   *    by cuckooing on insert or by insert_batch
+   */
+  long long key_moves(void) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    return key_moves_;
+  }
+
   /**
    * @brief Sends all the contents of a server from the left ring to the right ring
    * @param s the server_id of the server in the Left Ring that is being cuckooed over
@@ -125,16 +826,28 @@ public:
   void send_server_ltor(server_id s) {
     ++insert_counter;
     if (insert_counter > STOP_ITERS) {
+      ++cascades_cut_;
       return;
     }
+    ++cascade_steps_;
+    cascade_longest_ = std::max(cascade_longest_, insert_counter);
     server_id ret;
     vector<server_id> to_send;
-    vector<int>& lserver = left_ring_->get_keys(s);
+    Bucket& lserver = left_ring_->get_keys(s);
+    key_moves_ += lserver.size();
     for (const auto& i : lserver) {
-      ret = right_ring_->insert(i);
+      // one search finds the key's new server for both the insert and the event
+      MapIterator r = right_ring_->find_server(i);
+      ret = right_ring_->insert_at(r, i);
       if (ret != -1) {
         to_send.push_back(ret);
       }
+      if (migrations_) {
+        migrations_->emit(i, 0, s, 1, r->first);
+      }
+      if (cache_.enabled()) {
+        cache_.invalidate(i);
+      }
     }
     left_ring_->clear_server(s);
     for (const auto& server : to_send) {
@@ -149,16 +862,27 @@ public:
   void send_server_rtol(server_id s) {
     ++insert_counter;
     if (insert_counter > STOP_ITERS) {
+      ++cascades_cut_;
       return;
     }
+    ++cascade_steps_;
+    cascade_longest_ = std::max(cascade_longest_, insert_counter);
     server_id ret;
     vector<server_id> to_send;
-    vector<int>& rserver = right_ring_->get_keys(s);
+    Bucket& rserver = right_ring_->get_keys(s);
+    key_moves_ += rserver.size();
     for (const auto& i : rserver) {
-      ret = left_ring_->insert(i);
+      MapIterator l = left_ring_->find_server(i);
+      ret = left_ring_->insert_at(l, i);
       if (ret != -1) {
         to_send.push_back(ret);
       }
+      if (migrations_) {
+        migrations_->emit(i, 1, s, 0, l->first);
+      }
+      if (cache_.enabled()) {
+        cache_.invalidate(i);
+      }
     }
     right_ring_->clear_server(s);
     for (const auto& server : to_send) {
@@ -168,23 +892,378 @@ public:
 
   /**
    * #param the key that is being removed
-   * @brief removes a key into the HashRing
-   * @brief Can be implemented by checking each ring and removing,
-   *    but we left it out since we are not using it.
+   * @brief removes a key from whichever ring holds it, using the
+   *    fingerprints of its two servers to find it
    */
   void remove(int key) {
-    (void)key;
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    if (cache_.enabled()) {
+      cache_.invalidate(key);
+    }
+    if (!left_ring_->remove_at(left_ring_->find_server(key), key)) {
+      right_ring_->remove_at(right_ring_->find_server(key), key);
+    }
+  }
+
+  /**
+   * #param the key that is being checked
+   * @brief Determines whether a key is in either ring
+   * @returns true if the key is there
+   */
+  bool contains(int key) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    return left_ring_->find_server(key)->second.contains(key) ||
+        right_ring_->find_server(key)->second.contains(key);
   }
 
   /**
    * #param the key that is being looked up
    * @brief Finds the server associated with a key
    * @returns server_id of the associated server
-   * @brief Not implemented because not needed for us.
    */
   server_id lookup (int key) {
-    (void)key;
-    return 0;
+    return locate(key).server;
+  }
+
+  /**
+   * #param the key that is being looked up
+   * @brief Finds where a key currently sits, checking its left ring server
+   *    and then its right ring server. A key that is in neither is reported
+   *    on the side insert would put it on.
+   * @returns the side and server_id of the associated server
+   */
+  Placement locate(int key) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    Placement p;
+    if (sketch_.enabled()) {
+      touch(key);
+    }
+    if (cache_.enabled() && cache_.probe(key, generation(), &p)) {
+      return p;
+    }
+    bool found;
+    p = place(key, &found);
+    // moving the key off of a dead server can overload its new one, and
+    // relieving that can move the key again
+    if (settle_overflow()) {
+      p = place(key, &found);
+    }
+    // where a missing key would go changes with every insert, so only
+    // keys that are stored are cached
+    if (found && cache_.enabled()) {
+      cache_.fill(key, generation(), p);
+    }
+    return p;
+  }
+
+  /**
+   * @brief Puts a direct-mapped cache of key to Placement in front of lookup
+   *    and locate. Membership changes drop all of its entries, and cuckoo
+   *    moves drop the keys they move.
+   * @param entries the number of entries, or 0 to turn the cache off
+   */
+  void enable_lookup_cache(size_t entries) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    cache_ = entries ? LookupCache<Placement>(entries) : LookupCache<Placement>();
+  }
+
+  /**
+   * @brief the number of lookups answered by the cache
+   */
+  long long lookup_cache_hits(void) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    return cache_.hits();
+  }
+
+  /**
+   * @brief the number of lookups the cache could not answer
+   */
+  long long lookup_cache_misses(void) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    return cache_.misses();
+  }
+
+  /**
+   * @brief Tracks how often each key is inserted or looked up in a
+   *    count-min sketch, and balances by weight from then on: insert puts a
+   *    key on the lighter of its two servers by weight, rebalance_weighted
+   *    moves keys off of the heaviest servers, and route names both servers
+   *    of a hot key to serve it from. SERVER_THRESHOLD still bounds how many
+   *    keys a server holds.
+   * @param width the number of counters in each of the sketch's 4 rows,
+   *    or 0 to turn tracking off
+   * @param hot_fraction the share of recent accesses that makes a key hot
+   */
+  void track_hot_keys(size_t width, double hot_fraction = HOT_FRACTION) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    sketch_ = width ? CountMinSketch(width) : CountMinSketch();
+    hot_fraction_ = hot_fraction;
+    hot_.clear();
+    hot_by_server_.clear();
+  }
+
+  /**
+   * #param the key that is being requested
+   * @brief Finds the servers that should serve requests for a key. Any key
+   *    is served where it sits. A hot key is also served by its server on
+   *    the other ring, which doesn't hold it: the caller keeps a copy of the
+   *    key there and spreads the key's requests evenly over the two, which
+   *    is what the weights of both servers assume.
+   * @returns the side and server_id of the server holding the key, then,
+   *    for a hot key, of its other server
+   */
+  std::vector<Placement> route(int key) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    std::vector<Placement> servers(1, locate(key));
+    auto h = hot_.find(key);
+    if (h != hot_.end()) {
+      refresh_hot();
+      Placement other;
+      other.side = 1 - servers[0].side;
+      other.server = other.side ? h->second.right : h->second.left;
+      servers.push_back(other);
+    }
+    return servers;
+  }
+
+  /**
+   * @brief Whether a key is hot enough to be served from both of its servers
+   */
+  bool is_hot(int key) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    return hot_.find(key) != hot_.end();
+  }
+
+  /**
+   * @brief the number of keys that are hot now
+   */
+  size_t num_hot_keys(void) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    return hot_.size();
+  }
+
+  /**
+   * @brief the estimated number of recent accesses to a key, or 0 when hot
+   *    keys are not tracked
+   */
+  long long accesses(int key) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    return sketch_.estimate(key);
+  }
+
+  /**
+   * @brief The load of a server by weight: one for each key it holds plus
+   *    the recent accesses it serves, with those of hot keys shared with
+   *    their other server
+   * @param side the ring of the server, 0 for left and 1 for right
+   * @param s the server_id of the server
+   * @returns the load, or -1 if there is no such server
+   */
+  long long weighted_load(int side, server_id s) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    RingHash* ring = side ? right_ring_ : left_ring_;
+    MapIterator m = ring->cache_indices_.find(s);
+    return m == ring->cache_indices_.end() ? -1 : server_weight(side, m);
+  }
+
+  /**
+   * @brief finds the server with the highest load by weight
+   * @returns the load of that server
+   */
+  long long get_max_weighted_load(void) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    long long most = 0;
+    RingHash* rings[2] = { left_ring_, right_ring_ };
+    for (int side = 0; side < 2; ++side) {
+      for (MapIterator m = rings[side]->cache_indices_.begin(); m != rings[side]->cache_indices_.end(); ++m) {
+        most = std::max(most, server_weight(side, m));
+      }
+    }
+    return most;
+  }
+
+  /**
+   * @brief Evens out the load by weight. Keys on dead servers are swept
+   *    first. Then, from the heaviest server down, each server's keys are
+   *    tried heaviest first, and a key moves to its other server when that
+   *    server has room and would still be lighter than this one is now, so
+   *    every move lowers the heavier of the two servers it touches. Hot keys
+   *    are already split between their servers and stay where they are.
+   * @returns the number of keys moved, or 0 when hot keys are not tracked
+   */
+  long long rebalance_weighted(void) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    if (!sketch_.enabled()) {
+      return 0;
+    }
+    sweep(LLONG_MAX);
+    RingHash* rings[2] = { left_ring_, right_ring_ };
+    std::unordered_map<unsigned long long, long long> weight;
+    std::vector<std::pair<long long, std::pair<int, MapIterator> > > order;
+    for (int side = 0; side < 2; ++side) {
+      for (MapIterator m = rings[side]->cache_indices_.begin(); m != rings[side]->cache_indices_.end(); ++m) {
+        if (rings[side]->dead_.find(m->first) != rings[side]->dead_.end()) {
+          continue;
+        }
+        long long w = server_weight(side, m);
+        weight[((unsigned long long) m->first << 1) | side] = w;
+        order.push_back(std::make_pair(w, std::make_pair(side, m)));
+      }
+    }
+    std::sort(order.begin(), order.end(),
+        [](const std::pair<long long, std::pair<int, MapIterator> >& a,
+           const std::pair<long long, std::pair<int, MapIterator> >& b) { return a.first > b.first; });
+
+    long long moved = 0;
+    std::vector<std::pair<long long, int> > keys;
+    for (const auto& o : order) {
+      int side = o.second.first;
+      MapIterator from = o.second.second;
+      long long& from_weight = weight[((unsigned long long) from->first << 1) | side];
+      keys.clear();
+      for (const auto& key : from->second) {
+        if (hot_.find(key) == hot_.end()) {
+          keys.push_back(std::make_pair(key_weight(key), key));
+        }
+      }
+      std::sort(keys.rbegin(), keys.rend());
+      for (const auto& k : keys) {
+        MapIterator to = rings[1 - side]->find_server(k.second);
+        long long& to_weight = weight[((unsigned long long) to->first << 1) | (1 - side)];
+        if (to->second.size() >= SERVER_THRESHOLD || to_weight + k.first >= from_weight) {
+          continue;
+        }
+        move_key(k.second, side, from, to);
+        from_weight -= k.first;
+        to_weight += k.first;
+        ++moved;
+      }
+    }
+    return moved;
+  }
+
+  /**
+   * @brief A number that changes whenever either ring's membership changes
+   */
+  unsigned long long generation(void) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    return left_ring_->generation() + right_ring_->generation();
+  }
+
+  /**
+   * #param the key that is being looked up
+   * @brief Finds r distinct servers for the replicas of a key. The first is
+   *    where the key currently sits and the second is its candidate on the
+   *    other ring; after that the two rings' successors alternate. Each ring
+   *    is searched once, and walked on from the server the search found.
+   * @param r the number of servers wanted
+   * @returns vector of the sides and server_ids of those servers
+   */
+  std::vector<Placement> lookup_n(int key, int r) {
+    std::vector<Placement> servers;
+    lookup_n(key, r, servers);
+    return servers;
+  }
+
+  /**
+   * @brief Same as lookup_n above, but appends the servers to out
+   */
+  void lookup_n(int key, int r, std::vector<Placement>& out) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    if (sketch_.enabled()) {
+      touch(key);
+    }
+    bool found;
+    MapIterator at[2];
+    Placement home = place(key, &found, at);
+    if (settle_overflow()) {
+      home = place(key, &found, at);
+    }
+    if (at[1] == right_ring_->cache_indices_.end()) {
+      at[1] = right_ring_->find_server(key);
+    }
+    RingHash* rings[2] = { left_ring_, right_ring_ };
+    std::vector<server_id> same, other;
+    rings[home.side]->walk_n(at[home.side], (r + 1) / 2, same);
+    rings[1 - home.side]->walk_n(at[1 - home.side], r / 2, other);
+    Placement p;
+    for (size_t i = 0; i < same.size() || i < other.size(); ++i) {
+      if (i < same.size()) {
+        p.side = home.side;
+        p.server = same[i];
+        out.push_back(p);
+      }
+      if (i < other.size()) {
+        p.side = 1 - home.side;
+        p.server = other[i];
+        out.push_back(p);
+      }
+    }
+  }
+
+  /**
+   * @brief Finds the replica servers of a batch of keys
+   * @param keys the keys being looked up
+   * @param r the number of servers wanted for each key
+   * @param out the servers are appended here, in key order
+   */
+  void lookup_n(const std::vector<int>& keys, int r, std::vector<Placement>& out) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    // no key gets more servers than are live on the two rings together
+    out.reserve(out.size() + keys.size() *
+        std::min(std::max(r, 0), left_ring_->size() + right_ring_->size()));
+    for (const auto& key : keys) {
+      lookup_n(key, r, out);
+    }
+  }
+
+  /**
+   * @brief Finds where many keys are, as locate does, LOOKUP_GROUP at a time.
+   *    Both candidate servers of every key in a group and their buckets are
+   *    prefetched before any of the group's buckets is searched. Without
+   *    the lookup index on both rings, or with dead servers, this is one
+   *    locate after another.
+   * @param out filled with the placement of each key, in order
+   */
+  void lookup_batch(const std::vector<int>& keys, std::vector<Placement>& out) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    out.resize(keys.size());
+    if (left_ring_->index_.empty() || right_ring_->index_.empty() ||
+        !left_ring_->dead_.empty() || !right_ring_->dead_.empty()) {
+      for (size_t i = 0; i < keys.size(); ++i) {
+        out[i] = locate(keys[i]);
+      }
+      return;
+    }
+    long long group[LOOKUP_GROUP];
+    MapIterator l[LOOKUP_GROUP], r[LOOKUP_GROUP];
+    for (size_t base = 0; base < keys.size(); base += LOOKUP_GROUP) {
+      size_t n = std::min((size_t) LOOKUP_GROUP, keys.size() - base);
+      for (size_t i = 0; i < n; ++i) {
+        group[i] = keys[base + i];
+        if (sketch_.enabled()) {
+          touch(keys[base + i]);
+        }
+      }
+      left_ring_->find_servers(group, n, l, true);
+      right_ring_->find_servers(group, n, r, true);
+      for (size_t i = 0; i < n; ++i) {
+        Placement& p = out[base + i];
+        if (l[i]->second.contains(keys[base + i])) {
+          p.side = 0;
+          p.server = l[i]->first;
+        }
+        else if (r[i]->second.contains(keys[base + i]) || (sketch_.enabled() ?
+            prefer_right(l[i], r[i]) : left_ring_->num_keys() > right_ring_->num_keys())) {
+          p.side = 1;
+          p.server = r[i]->first;
+        }
+        else {
+          p.side = 0;
+          p.server = l[i]->first;
+        }
+      }
+    }
   }
 
   /**
@@ -193,7 +1272,7 @@ public:
    *    not implemented because not needed for us
    * @returns void
    */
-  void add_server(int server_loc) {
+  void add_server(long long server_loc) {
     (void)server_loc;
   }
 
@@ -205,6 +1284,7 @@ public:
    */
   // removes from left if side = 0, from right if side = 1
   void remove_random_server(server_id s, int side) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
     (void) s;
     if (side == 0){
       left_ring_->remove_random_server();
@@ -215,22 +1295,268 @@ public:
     return;
   }
 
+  /**
+   * @brief Turns on the direct-mapped lookup index of both rings
+   * @param slots the number of slots in each, or 0 for one per server
+   */
+  void enable_lookup_index(size_t slots = 0) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    left_ring_->enable_lookup_index(slots);
+    right_ring_->enable_lookup_index(slots);
+  }
+
+  /**
+   * @brief Marks a random server on the specified side as dead, leaving its
+   *    keys to move lazily
+   * @param side The side to remove the server from
+   */
+  void remove_random_server_lazy(int side) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    if (side == 0) {
+      left_ring_->remove_server_lazy(left_ring_->random_server());
+    }
+    else {
+      right_ring_->remove_server_lazy(right_ring_->random_server());
+    }
+  }
+
+  /**
+   * @brief Moves keys off of dead servers on both rings, then cuckoos any
+   *    server the moves pushed over SERVER_THRESHOLD
+   * @param max_keys the most keys to move on each ring in this call
+   * @returns the number of keys moved off of dead servers
+   */
+  long long sweep(long long max_keys) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    long long moved = left_ring_->sweep(max_keys) + right_ring_->sweep(max_keys);
+    settle_overflow();
+    return moved;
+  }
+
+  /**
+   * @brief Adds and removes a batch of servers on the specified side in one
+   *    rebalance pass, then cuckoos any server left over the threshold
+   * @param adds locations of the servers to be added
+   * @param removes server_ids of the servers to be removed
+   * @param side The side to change, 0 for left and 1 for right
+   */
+  void apply_membership_changes(const std::vector<long long>& adds,
+      const std::vector<server_id>& removes, int side) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    if (side == 0) {
+      for (const auto& s : left_ring_->apply_membership_changes(adds, removes)) {
+        if (background_) {
+          defer(0, s);
+          continue;
+        }
+        insert_counter = 0;
+        ++cascades_;
+        send_server_ltor(s);
+      }
+    }
+    else {
+      for (const auto& s : right_ring_->apply_membership_changes(adds, removes)) {
+        if (background_) {
+          defer(1, s);
+          continue;
+        }
+        insert_counter = 0;
+        ++cascades_;
+        send_server_rtol(s);
+      }
+    }
+  }
+
+  /**
+   * @brief Reports every key that changes owner, whether from a membership
+   *    change on either ring or a cuckoo move, to a MigrationTracker
+   * @param tracker the tracker to report to, or NULL to turn this off
+   */
+  void set_migration_tracker(MigrationTracker* tracker) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    migrations_ = tracker;
+    left_ring_->set_migration_tracker(tracker, 0);
+    right_ring_->set_migration_tracker(tracker, 1);
+  }
+
+  /**
+   * #param the key that is being looked up
+   * @brief Finds every server that currently owns a key, on either ring.
+   *    While the key is being migrated, this is its new owner followed by
+   *    its old one, which may be on the other ring.
+   * @returns vector of Placements, the first being the one locate returns
+   */
+  std::vector<Placement> lookup_owners(int key) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    std::vector<Placement> owners(1, locate(key));
+    Migration m;
+    if (migrations_ && migrations_->in_flight(key, &m) &&
+        (m.from_side != owners[0].side || m.from != owners[0].server)) {
+      Placement old;
+      old.side = m.from_side;
+      old.server = m.from;
+      owners.push_back(old);
+    }
+    return owners;
+  }
+
+  /**
+   * @brief Keeps a copy of each ring's server positions on every NUMA node
+   * @param left the replicas of the left ring, or NULL to turn this off
+   * @param right the replicas of the right ring, or NULL to turn this off
+   */
+  void set_numa_replicas(NumaReplicas* left, NumaReplicas* right) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    left_ring_->set_numa_replicas(left);
+    right_ring_->set_numa_replicas(right);
+  }
+
+  /**
+   * #param the key that is being looked up
+   * @brief Finds both candidate servers of a key using the replicas on the
+   *    calling thread's NUMA node. Which of the two holds the key is kept
+   *    with the keys themselves, so it is not answered here. Without
+   *    set_numa_replicas it falls back to the rings' lookup, which is not
+   *    safe to call while another thread changes the membership.
+   * @returns the server_ids on the left and right rings
+   */
+  std::pair<server_id, server_id> lookup_local(int key) {
+    return std::make_pair(left_ring_->lookup_local(key), right_ring_->lookup_local(key));
+  }
+
+  /**
+   * #param the key that is being looked up
+   * @brief Finds both candidate servers of a key, whichever of them holds it
+   * @returns the server_ids on the left and right rings
+   */
+  std::pair<server_id, server_id> candidates(int key) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    std::pair<server_id, server_id> servers(left_ring_->find_server(key)->first,
+        right_ring_->find_server(key)->first);
+    // finding a server can move keys off dead ones
+    settle_overflow();
+    return servers;
+  }
+
+  /**
+   * @brief Reseeds the random server choices of both rings, each with its own stream
+   */
+  void seed(uint64_t s) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    left_ring_->seed(s);
+    right_ring_->seed(s ^ 0x9e3779b97f4a7c15ULL);
+  }
+
+  /**
+   * @brief picks a server at random from the specified side
+   * @param side The side to pick from, 0 for left and 1 for right
+   * @returns the server_id of that server
+   */
+  server_id random_server(int side) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    if (side == 0) {
+      return left_ring_->random_server();
+    }
+    return right_ring_->random_server();
+  }
+
   /**
    * @brief Prints the loads on each server, 
    *    separated by a comma, followed by the total load
    */
   void print_loads(void) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
     cout << "Left ring loads are: " << "\n";
     left_ring_->print_loads();
     cout << "Right ring loads are: " << "\n";
     right_ring_->print_loads();
   }
 
+  /**
+   * @brief Adds the health of both rings, labelled side="left" and
+   *    side="right", and the cuckoo counters to a set of metrics, without
+   *    walking either ring
+   * @param out the metrics to add to
+   * @param labels labels telling this CuckooRings apart from others in out
+   */
+  void metrics(Metrics& out, const Metrics::Labels& labels = Metrics::Labels()) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    Metrics::Labels side(labels);
+    side["side"] = "left";
+    left_ring_->metrics(out, side);
+    side["side"] = "right";
+    right_ring_->metrics(out, side);
+    out.counter("cuckoo_cascades_total", "Cuckoo cascades started by an overloaded server",
+        labels, cascades_);
+    out.counter("cuckoo_cascade_steps_total", "Servers emptied into the other ring by cascades",
+        labels, cascade_steps_);
+    out.counter("cuckoo_cascades_cut_total",
+        "Servers left overloaded because a cascade reached STOP_ITERS", labels, cascades_cut_);
+    out.gauge("cuckoo_cascade_longest", "Most servers emptied by a single cascade",
+        labels, cascade_longest_);
+    out.counter("cuckoo_key_moves_total", "Keys moved between the rings", labels, key_moves_);
+    Background* b = background_;
+    if (b) {
+      out.gauge("cuckoo_rebalancer_pending", "Overloaded servers waiting for the background rebalancer",
+          labels, b->pending.size());
+      out.counter("cuckoo_rebalancer_moves_total", "Keys moved by the background rebalancer",
+          labels, b->moves);
+    }
+    if (sketch_.enabled()) {
+      out.gauge("cuckoo_hot_keys", "Keys served from both of their servers", labels, hot_.size());
+      out.gauge("cuckoo_sketch_accesses", "Recent accesses counted by the hot key sketch, with aging",
+          labels, sketch_.total());
+    }
+  }
+
+  /**
+   * @brief Breaks down the memory the CuckooRings uses by component: each
+   *    ring's, prefixed left_ and right_, then the object itself, the lookup
+   *    cache, the hot key sketch and table, and the background rebalancer
+   */
+  MemoryUsage memory_usage(void) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    MemoryUsage m;
+    m.add(left_ring_->memory_usage(), "left_");
+    m.add(right_ring_->memory_usage(), "right_");
+    m.add("object", sizeof(*this));
+    m.add("lookup_cache", MemoryUsage::heap_array(cache_.bytes()));
+    m.add("hot_key_sketch", MemoryUsage::heap_array(sketch_.bytes()));
+    long long hot_lists = 0;
+    for (const auto& l : hot_by_server_) {
+      hot_lists += MemoryUsage::heap_array(l.second.capacity() * sizeof(int));
+    }
+    m.add("hot_keys", (hot_.empty() && hot_.bucket_count() <= 1 ? 0 :
+        MemoryUsage::hash_table(hot_.size(), hot_.bucket_count(), sizeof(std::pair<const int, Hot>))) +
+        (hot_by_server_.empty() && hot_by_server_.bucket_count() <= 1 ? 0 :
+        MemoryUsage::hash_table(hot_by_server_.size(), hot_by_server_.bucket_count(),
+        sizeof(std::pair<const unsigned long long, std::vector<int> >)) + hot_lists));
+    Background* b = background_;
+    if (b) {
+      m.add("rebalancer", MemoryUsage::heap_block(sizeof(Background)) +
+          b->pending.size() * sizeof(std::pair<int, server_id>) +
+          MemoryUsage::hash_table(b->queued.size(), b->queued.bucket_count(),
+          sizeof(unsigned long long)));
+    }
+    return m;
+  }
+
+  /**
+   * @brief Gives back memory both rings hold but don't use, and repacks
+   *    each ring's map in ring order, as RingHash::compact does
+   * @returns the bytes given back, by memory_usage's count
+   */
+  size_t compact(void) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    return left_ring_->compact() + right_ring_->compact();
+  }
+
   /**
    * @brief evaluates the cost of a CuckooRing by determing the cost of each ring
    * @returns the cost as a long long
    */
   long long cost_of_structure(void){
+    std::unique_lock<std::recursive_mutex> lock = guard();
     return (left_ring_->cost_of_structure() + right_ring_->cost_of_structure());
   }
 
@@ -239,6 +1565,7 @@ public:
    * @returns the load of that server
    */
   long long get_max_load(void) {
+    std::unique_lock<std::recursive_mutex> lock = guard();
     return max(right_ring_->get_max_load(), left_ring_->get_max_load());
   }
 
@@ -247,7 +1574,8 @@ public:
    * @returns the load of that server
    */
   long long get_min_load(void){
-    return min(left_ring_->get_min_load(), left_ring_->get_min_load());
+    std::unique_lock<std::recursive_mutex> lock = guard();
+    return min(left_ring_->get_min_load(), right_ring_->get_min_load());
   }
 
   /**
@@ -255,6 +1583,7 @@ public:
    * @returns that number as a long long
    */
   long long getNumServers(void){
+    std::unique_lock<std::recursive_mutex> lock = guard();
     return (left_ring_->getNumServers() + right_ring_->getNumServers());
   }
 
@@ -263,6 +1592,7 @@ public:
    * @returns that number as a long long
    */
   long long getNumKeys(void){
+    std::unique_lock<std::recursive_mutex> lock = guard();
     return (left_ring_->getNumKeys() + right_ring_->getNumKeys());
   }
 
@@ -270,6 +1600,7 @@ public:
    * @brief adds a server to a random location in the specified side
    */
   void add_random_server(int side){
+    std::unique_lock<std::recursive_mutex> lock = guard();
     side = side % 2;
     if (side == 0) {
       left_ring_->add_random_server();
@@ -282,3 +1613,5 @@ public:
   }
 
 };
+
+#endif
@@ -0,0 +1,403 @@
+/** @class DomainRings
+ * @brief Two-level placement over failure domains (zones or racks). A key is
+ * first routed on a ring of domains and then on the RingHash of the servers
+ * inside that domain, so a lookup is always one search of each ring.
+ *
+ * With two choices on, every key also has an alternate domain, the first
+ * domain after its second hash that is not its first, and it lives in
+ * whichever of the two has the emptier server. Overloaded servers cuckoo
+ * their keys over to the keys' other domain, as in CuckooRings. The two
+ * choices of a key are never in the same domain.
+ *
+ * Losing a domain moves only the keys stored in it: every other key still
+ * has the domain it lives in as one of its choices afterwards.
+ *
+ * @author ankitvgupta
+ * @author jonahkall
+ */
+#ifndef DOMAINRINGS_HPP
+#define DOMAINRINGS_HPP
+
+#include <iostream>
+#include <map>
+#include <vector>
+#include <utility>
+
+#include "cuckoorings.hpp"
+
+// The number of positions each domain has on the ring of domains
+#define DOMAIN_VNODES 64
+
+/**
+ * A server in a DomainRings, given by its domain and its server_id there
+ */
+struct DomainPlacement {
+  int domain;
+  long long server;
+};
+
+class DomainRings {
+private:
+  typedef long long server_id;
+  typedef RingHash::MapIterator MapIterator;
+
+  long long kss_;
+  bool two_choice_;
+
+  /**
+   * The ring of domains, from position to domain id
+   */
+  std::map<unsigned long long, int> domain_ring_;
+
+  /**
+   * The servers of each domain
+   */
+  std::map<int, RingHash*> domains_;
+
+  unsigned insert_counter;
+  long long keys_moved_;
+
+  /**
+   * @brief The two positions of a key on the ring of domains
+   */
+  unsigned long long domain_hash(long long key, int choice) {
+    uint64_t x = (uint64_t) key;
+    if (choice) {
+      x ^= 0x9e3779b97f4a7c15ULL;
+    }
+    return fastrange(util::Fingerprint(x), kss_);
+  }
+
+  std::map<unsigned long long, int>::iterator domain_successor(unsigned long long pos) {
+    std::map<unsigned long long, int>::iterator it = domain_ring_.lower_bound(pos);
+    return it == domain_ring_.end() ? domain_ring_.begin() : it;
+  }
+
+  /**
+   * @brief Finds the domains a key can live in. Without two choices, or
+   *    with a single domain, both are the same.
+   */
+  std::pair<int, int> candidates(long long key) {
+    int first = domain_successor(domain_hash(key, 0))->second;
+    if (!two_choice_) {
+      return std::make_pair(first, first);
+    }
+    std::map<unsigned long long, int>::iterator it = domain_successor(domain_hash(key, 1));
+    for (size_t i = 0; i < domain_ring_.size() && it->second == first; ++i) {
+      if (++it == domain_ring_.end()) {
+        it = domain_ring_.begin();
+      }
+    }
+    return std::make_pair(first, it->second);
+  }
+
+  /**
+   * @brief Puts a key in a domain, cuckooing the server it lands on if that
+   *    server goes over SERVER_THRESHOLD
+   */
+  void place(int key, int domain) {
+    server_id over = domains_[domain]->insert(key);
+    if (over != -1 && two_choice_) {
+      send_server(domain, over);
+    }
+  }
+
+  /**
+   * @brief Sends every key of a server to the other domain of that key
+   */
+  void send_server(int domain, server_id s) {
+    ++insert_counter;
+    if (insert_counter > STOP_ITERS) {
+      return;
+    }
+    RingHash* ring = domains_[domain];
+    std::vector<int> keys(ring->get_keys(s).begin(), ring->get_keys(s).end());
+    ring->clear_server(s);
+    std::vector<std::pair<int, server_id> > to_send;
+    for (const auto& key : keys) {
+      std::pair<int, int> c = candidates(key);
+      int other = c.first == domain ? c.second : c.first;
+      ++keys_moved_;
+      server_id over = domains_[other]->insert(key);
+      if (over != -1) {
+        to_send.push_back(std::make_pair(other, over));
+      }
+    }
+    for (const auto& x : to_send) {
+      send_server(x.first, x.second);
+    }
+  }
+
+  /**
+   * @brief Finds the server of a key in a domain
+   */
+  MapIterator find_in(int domain, long long key) {
+    return domains_[domain]->find_server(key);
+  }
+
+  /**
+   * @brief Of the two domains of a key, the one whose server for it has fewer keys
+   */
+  int lighter(long long key, std::pair<int, int> c) {
+    if (c.first == c.second) {
+      return c.first;
+    }
+    return find_in(c.second, key)->second.size() < find_in(c.first, key)->second.size() ?
+        c.second : c.first;
+  }
+
+public:
+  /**
+   * Constructor for DomainRings
+   * @param key_space_size the size of both levels of rings
+   * @param two_choice whether each key also has an alternate domain
+   */
+  DomainRings(long long key_space_size, bool two_choice) :
+      kss_(key_space_size), two_choice_(two_choice), insert_counter(0),
+      keys_moved_(0) {}
+
+  /**
+   * Destructor
+   */
+  ~DomainRings() {
+    for (auto& d : domains_) {
+      delete d.second;
+    }
+  }
+
+  /**
+   * @brief Adds a domain with evenly spaced servers. Only the keys that no
+   *    longer have the domain they are stored in as a choice move.
+   * @param domain the id of the new domain
+   * @param servers the number of servers in it
+   */
+  void add_domain(int domain, int servers) {
+    if (domains_.find(domain) != domains_.end()) {
+      return;
+    }
+    bool first_domain = domains_.empty();
+    domains_[domain] = new RingHash(kss_, servers);
+    for (int i = 0; i < DOMAIN_VNODES; ++i) {
+      uint64_t id = ((uint64_t) domain << 32) | i;
+      domain_ring_[fastrange(util::Fingerprint(id), kss_)] = domain;
+    }
+    if (first_domain) {
+      return;
+    }
+
+    // take out the keys whose choices no longer include where they are
+    std::vector<int> displaced;
+    for (auto& d : domains_) {
+      if (d.first == domain) {
+        continue;
+      }
+      for (auto& server : d.second->cache_indices_) {
+        RingHash::Bucket& keys = server.second;
+        size_t kept = 0;
+        for (size_t i = 0; i < keys.size(); ++i) {
+          std::pair<int, int> c = candidates(keys[i]);
+          if (c.first == d.first || c.second == d.first) {
+            keys.set(kept++, keys[i]);
+          }
+          else {
+            displaced.push_back(keys[i]);
+          }
+        }
+        d.second->num_keys_ -= keys.size() - kept;
+        d.second->count_load(keys.size(), kept);
+        keys.resize(kept);
+      }
+    }
+    keys_moved_ += displaced.size();
+    for (const auto& key : displaced) {
+      insert_counter = 0;
+      std::pair<int, int> c = candidates(key);
+      place(key, two_choice_ ? lighter(key, c) : c.first);
+    }
+  }
+
+  /**
+   * @brief Takes a whole domain out, as when a rack or zone fails. Its keys
+   *    go to their other domain, or to the next domain on the ring without
+   *    two choices; no other key moves.
+   * @param domain the id of the domain
+   */
+  void remove_domain(int domain) {
+    std::map<int, RingHash*>::iterator gone = domains_.find(domain);
+    if (gone == domains_.end() || domains_.size() == 1) {
+      return;
+    }
+    RingHash* ring = gone->second;
+    domains_.erase(gone);
+    for (auto it = domain_ring_.begin(); it != domain_ring_.end(); ) {
+      if (it->second == domain) {
+        domain_ring_.erase(it++);
+      }
+      else {
+        ++it;
+      }
+    }
+    for (const auto& server : ring->cache_indices_) {
+      for (const auto& key : server.second) {
+        ++keys_moved_;
+        insert_counter = 0;
+        std::pair<int, int> c = candidates(key);
+        place(key, two_choice_ ? lighter(key, c) : c.first);
+      }
+    }
+    delete ring;
+  }
+
+  /**
+   * @brief Adds a server to a domain. Keys only move within the domain.
+   */
+  void add_server(int domain, long long server_loc) {
+    if (domains_.find(domain) == domains_.end()) {
+      return;
+    }
+    insert_counter = 0;
+    for (const auto& s : domains_[domain]->apply_membership_changes(
+        std::vector<long long>(1, server_loc), std::vector<server_id>())) {
+      if (two_choice_) {
+        send_server(domain, s);
+      }
+    }
+  }
+
+  /**
+   * @brief Removes a server from a domain. Keys only move within the domain.
+   */
+  void remove_server(int domain, server_id s) {
+    if (domains_.find(domain) == domains_.end()) {
+      return;
+    }
+    insert_counter = 0;
+    for (const auto& over : domains_[domain]->apply_membership_changes(
+        std::vector<long long>(), std::vector<server_id>(1, s))) {
+      if (two_choice_) {
+        send_server(domain, over);
+      }
+    }
+  }
+
+  /**
+   * #param the key that is being inserted
+   * @brief Inserts a key into the emptier of its two choices, or its only one
+   */
+  void insert(int key) {
+    if (domains_.empty() || contains(key)) {
+      return;
+    }
+    insert_counter = 0;
+    std::pair<int, int> c = candidates(key);
+    place(key, two_choice_ ? lighter(key, c) : c.first);
+  }
+
+  /**
+   * #param the key that is being removed
+   * @brief Removes a key from whichever of its domains holds it
+   */
+  void remove(int key) {
+    if (domains_.empty()) {
+      return;
+    }
+    std::pair<int, int> c = candidates(key);
+    if (!domains_[c.first]->remove_at(find_in(c.first, key), key) && c.second != c.first) {
+      domains_[c.second]->remove_at(find_in(c.second, key), key);
+    }
+  }
+
+  /**
+   * #param the key that is being checked
+   * @brief Determines whether a key is in either of its domains
+   */
+  bool contains(int key) {
+    if (domains_.empty()) {
+      return false;
+    }
+    std::pair<int, int> c = candidates(key);
+    return find_in(c.first, key)->second.contains(key) ||
+        (c.second != c.first && find_in(c.second, key)->second.contains(key));
+  }
+
+  /**
+   * #param the key that is being looked up
+   * @brief Finds the domain and server of a key: one search of the ring of
+   *    domains and one of each candidate domain's ring
+   * @returns the placement of the key, or where it would be inserted if absent
+   */
+  DomainPlacement lookup(int key) {
+    DomainPlacement p;
+    std::pair<int, int> c = candidates(key);
+    MapIterator m = find_in(c.first, key);
+    p.domain = c.first;
+    p.server = m->first;
+    if (c.second != c.first && !m->second.contains(key)) {
+      MapIterator alt = find_in(c.second, key);
+      if (alt->second.contains(key) || alt->second.size() < m->second.size()) {
+        p.domain = c.second;
+        p.server = alt->first;
+      }
+    }
+    return p;
+  }
+
+  /**
+   * @brief the domains a key can be stored in
+   */
+  std::pair<int, int> candidate_domains(int key) {
+    return candidates(key);
+  }
+
+  /**
+   * @brief the number of keys moved by membership changes and cuckooing so far
+   */
+  long long keys_moved(void) {
+    return keys_moved_;
+  }
+
+  int num_domains(void) {
+    return domains_.size();
+  }
+
+  /**
+   * @brief the number of keys stored in one domain
+   */
+  long long domain_keys(int domain) {
+    return domains_.count(domain) ? domains_[domain]->getNumKeys() : 0;
+  }
+
+  long long getNumKeys(void) {
+    long long total = 0;
+    for (auto& d : domains_) {
+      total += d.second->getNumKeys();
+    }
+    return total;
+  }
+
+  long long getNumServers(void) {
+    long long total = 0;
+    for (auto& d : domains_) {
+      total += d.second->getNumServers();
+    }
+    return total;
+  }
+
+  long long get_max_load(void) {
+    long long max = 0;
+    for (auto& d : domains_) {
+      max = std::max(max, d.second->get_max_load());
+    }
+    return max;
+  }
+
+  long long cost_of_structure(void) {
+    long long cost = 0;
+    for (auto& d : domains_) {
+      cost += d.second->cost_of_structure();
+    }
+    return cost;
+  }
+};
+
+#endif
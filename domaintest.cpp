@@ -0,0 +1,77 @@
+/*
+ *  Tests placement over failure domains.
+ *  Spread 1000000 servers over 20 racks and add 1000000 keys. For CuckooRings, with
+ *  servers assigned to racks by hash, count the keys whose two choices are in the same
+ *  rack. Then fail one rack of a DomainRings, with and without two choices, and track
+ *  how many keys move compared to how many the rack held, and the time it takes.
+ * @author Ankit Gupta
+ * @author Jonah Kallenbach
+ */
+
+#include <iostream>
+#include <string>
+#include <time.h>
+#include <assert.h>
+#include <stdlib.h>
+
+#include "domainrings.hpp"
+
+using namespace std;
+
+#define RACKS 20
+
+/**
+ * @brief the rack a server of a flat CuckooRings is in, picked by hash since the
+ *    rings know nothing about racks. Servers are named by ring and position.
+ */
+long long rack_of(int side, long long server) {
+  return hashstd(2 * server + side, RACKS);
+}
+
+int main ()
+{
+  // initialize variables and seed the random number generator
+  clock_t t1, t2;
+  srand (time(NULL));
+  int i;
+
+  // a flat CuckooRings knows nothing about racks
+  CuckooRings c((1L << 32), 500000);
+  long long same_rack = 0;
+  for (i = 1; i <= 1000000; ++i) {
+    pair<long long, long long> servers = c.candidates(i);
+    same_rack += rack_of(0, servers.first) == rack_of(1, servers.second);
+  }
+  cout << "CuckooRings" << endl;
+  cout << "    Keys with both choices in one rack: " << same_rack << endl;
+
+  for (int two_choice = 0; two_choice < 2; ++two_choice) {
+    DomainRings d((1L << 32), two_choice);
+    for (i = 0; i < RACKS; ++i) {
+      d.add_domain(i, 1000000 / RACKS);
+    }
+    t1 = clock();
+    for (i = 1; i <= 1000000; ++i) {
+      d.insert(i);
+    }
+    t2 = clock();
+    cout << "DomainRings, " << (two_choice ? "two choices" : "one choice") << endl;
+    cout << "    Insert time (sec): " << ((float) (t2 - t1))/CLOCKS_PER_SEC << endl;
+    cout << "    Cost: " << ((float) d.cost_of_structure()) / d.getNumServers() << endl;
+    cout << "    Max load: " << d.get_max_load() << endl;
+
+    // fail a whole rack
+    int rack = rand() % RACKS;
+    long long held = d.domain_keys(rack);
+    long long before = d.keys_moved();
+    t1 = clock();
+    d.remove_domain(rack);
+    t2 = clock();
+    cout << "    Rack outage time (sec): " << ((float) (t2 - t1))/CLOCKS_PER_SEC << endl;
+    cout << "    Keys in the rack: " << held << ", keys moved: " << d.keys_moved() - before << endl;
+    cout << "    Max load after: " << d.get_max_load() << endl;
+    assert(d.getNumKeys() == 1000000);
+  }
+
+  return 0;
+}
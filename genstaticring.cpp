@@ -0,0 +1,95 @@
+/*
+ *  Writes a header holding a StaticRing for a fixed list of servers, so that a
+ *  deployment whose servers never change can look keys up with no ring to build.
+ *  The servers are either spread evenly, as RingHash(key space size, servers)
+ *  places them, or read from a file with one position per line, such as the
+ *  server_ids of a RingHash after add_server. Duplicate positions are dropped,
+ *  as the RingHash drops them. The ring hashes keys with hashstd, the hash of
+ *  RingHash and of the left ring of CuckooRings, or with hash_wang64, the hash
+ *  of the right ring.
+ *
+ *  Usage: genstaticring <name> <key space size> <servers|positions file> [left|right] > name.hpp
+ * @author Ankit Gupta
+ * @author Jonah Kallenbach
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdlib.h>
+
+#include "staticring.hpp"
+
+using namespace std;
+
+int main (int argc, char** argv)
+{
+  if (argc < 4) {
+    cerr << "Usage: " << argv[0]
+         << " <name> <key space size> <servers|positions file> [left|right] > name.hpp" << endl;
+    return 1;
+  }
+  string name = argv[1];
+  long long kss = atoll(argv[2]);
+  string servers = argv[3];
+  string hash = argc > 4 && string(argv[4]) == "right" ? "hash_wang64" : "hashstd";
+  if (kss <= 0) {
+    cerr << "The key space size has to be positive" << endl;
+    return 1;
+  }
+
+  vector<long long> positions;
+  if (servers.find_first_not_of("0123456789") == string::npos) {
+    long long n = atoll(servers.c_str());
+    for (long long i = 0; i < n; ++i) {
+      positions.push_back(even_position(i, n, kss));
+    }
+  }
+  else {
+    ifstream in(servers.c_str());
+    if (!in) {
+      cerr << "Can't read " << servers << endl;
+      return 1;
+    }
+    long long pos;
+    while (in >> pos) {
+      if (pos < 0 || pos >= kss) {
+        cerr << "Position " << pos << " is outside the key space" << endl;
+        return 1;
+      }
+      positions.push_back(pos);
+    }
+  }
+  sort(positions.begin(), positions.end());
+  positions.erase(unique(positions.begin(), positions.end()), positions.end());
+  if (positions.empty()) {
+    cerr << "A StaticRing needs at least one server" << endl;
+    return 1;
+  }
+
+  unsigned long long scale = static_ring_scale(positions.size(), kss);
+  vector<uint32_t> index(positions.size());
+  build_static_ring_index(positions.data(), positions.size(), scale, index.data());
+
+  string guard = name;
+  transform(guard.begin(), guard.end(), guard.begin(), ::toupper);
+  guard += "_HPP";
+  cout << "/* Generated by genstaticring: " << positions.size() << " servers, key space size "
+       << kss << ", " << hash << ". Do not edit. */" << endl;
+  cout << "#ifndef " << guard << endl << "#define " << guard << endl << endl;
+  cout << "#include \"staticring.hpp\"" << endl << endl;
+  cout << "constexpr StaticRing<" << positions.size() << ", " << hash << "> " << name << " = {" << endl;
+  cout << "  " << kss << "LL, " << scale << "ULL," << endl << "  {";
+  for (size_t i = 0; i < positions.size(); ++i) {
+    cout << (i % 6 ? " " : "\n    ") << positions[i] << "LL" << (i + 1 < positions.size() ? "," : "");
+  }
+  cout << endl << "  }," << endl << "  {";
+  for (size_t i = 0; i < index.size(); ++i) {
+    cout << (i % 12 ? " " : "\n    ") << index[i] << (i + 1 < index.size() ? "," : "");
+  }
+  cout << endl << "  }" << endl << "};" << endl << endl << "#endif" << endl;
+
+  return 0;
+}
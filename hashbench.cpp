@@ -0,0 +1,108 @@
+/*
+ *  Tests the speed and spread of the ring hash functions.
+ *  Hash 10000000 sequential keys and 10000000 random keys onto a key space of 2^32
+ *  with the hashes the rings use and with FarmHash, each reduced with fastrange,
+ *  and with the Wang 32 bit hash the left ring used before, reduced both with
+ *  fastrange and with the modulo it used before that. Track
+ *  the time per hash and a chi-square test of how evenly the keys fill 1024 equal
+ *  arcs of the ring. With 1023 degrees of freedom the statistic of a random hash
+ *  is about 1023, give or take 45. A z score over 3 means the arcs are uneven; one
+ *  well under -3 means they are more even than chance, as a bijection on
+ *  sequential keys can make them.
+ * @author Ankit Gupta
+ * @author Jonah Kallenbach
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <math.h>
+#include <time.h>
+#include <stdlib.h>
+
+#include "cuckoorings.hpp"
+#include "farmhash.hpp"
+
+using namespace std;
+
+#define KEYS 10000000
+#define ARCS 1024
+#define KSS (1LL << 32)
+
+long long wang32_modulo(long long a, long long kss_) {
+  a = (a+0x7ed55d16) + (a<<12);
+  a = (a^0xc761c23c) ^ (a>>19);
+  a = (a+0x165667b1) + (a<<5);
+  a = (a+0xd3a2646c) ^ (a<<9);
+  a = (a+0xfd7046c5) + (a<<3);
+  a = (a^0xb55a4f09) ^ (a>>16);
+  return abs(((a % kss_) + kss_) % kss_);
+}
+
+long long wang32(long long key, long long kss_) {
+  uint32_t a = (uint32_t) (key ^ (key >> 32));
+  a = (a+0x7ed55d16) + (a<<12);
+  a = (a^0xc761c23c) ^ (a>>19);
+  a = (a+0x165667b1) + (a<<5);
+  a = (a+0xd3a2646c) ^ (a<<9);
+  a = (a+0xfd7046c5) + (a<<3);
+  a = (a^0xb55a4f09) ^ (a>>16);
+  return fastrange((uint64_t) a << 32, kss_);
+}
+
+long long farmhash(long long a, long long kss_) {
+  return fastrange(util::Fingerprint((uint64_t) a), kss_);
+}
+
+/**
+ * @brief Times a hash over the keys and prints ns/hash and the chi-square
+ *    statistic of the arcs the positions fall in
+ */
+template <typename Hash>
+void measure(const string& name, Hash hash, const vector<long long>& keys) {
+  vector<long long> arcs(ARCS, 0);
+  volatile long long sink = 0;
+  long long sum = 0;
+
+  auto start = chrono::steady_clock::now();
+  for (const auto& k : keys) {
+    sum += hash(k, KSS);
+  }
+  double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+  sink = sum;
+  (void) sink;
+
+  for (const auto& k : keys) {
+    ++arcs[hash(k, KSS) / (KSS / ARCS)];
+  }
+  double expected = (double) keys.size() / ARCS, chi2 = 0;
+  for (const auto& n : arcs) {
+    chi2 += (n - expected) * (n - expected) / expected;
+  }
+  cout << "    " << name << ": " << ns / keys.size() << " ns/hash, chi-square " << chi2
+       << " (z " << (chi2 - (ARCS - 1)) / sqrt(2.0 * (ARCS - 1)) << ")" << endl;
+}
+
+int main ()
+{
+  // initialize variables and seed the random number generator
+  srand (time(NULL));
+  vector<long long> sequential, random;
+  for (long long i = 1; i <= KEYS; ++i) {
+    sequential.push_back(i);
+    random.push_back(((long long) rand() << 31) ^ rand());
+  }
+
+  for (int pass = 0; pass < 2; ++pass) {
+    const vector<long long>& keys = pass ? random : sequential;
+    cout << (pass ? "Random keys" : "Sequential keys") << endl;
+    measure("Wang 32 bit, modulo", wang32_modulo, keys);
+    measure("Wang 32 bit, fastrange", wang32, keys);
+    measure("fmix64 (hashstd, hash_left)", hashstd, keys);
+    measure("Wang 64 bit (hash_right)", CuckooRings::hash_right, keys);
+    measure("FarmHash Fingerprint", farmhash, keys);
+  }
+
+  return 0;
+}
@@ -0,0 +1,66 @@
+/** @file hashes.hpp
+ * @brief The hash functions that place keys on the rings, shared by
+ * RingHash, CuckooRings and StaticRing so that all of them put a key in the
+ * same place.
+ *
+ * @author ankitvgupta
+ * @author jonahkall
+ */
+#ifndef HASHES_HPP
+#define HASHES_HPP
+
+#include <stdint.h>
+
+/**
+ * @brief Maps a 64 bit hash onto [0, kss_) with one multiply instead of a
+ *    division: the high 64 bits of h * kss_ (Lemire's fastrange). It keeps the
+ *    high bits of h, so h has to be well mixed there.
+ * @param h the hash
+ * @param kss_ the key space size, at least 1
+ * @returns a position between 0 and kss_
+ */
+inline long long fastrange(uint64_t h, long long kss_) {
+  return (long long) (((unsigned __int128) h * (uint64_t) kss_) >> 64);
+}
+
+/**
+ * @brief A standard hash function used in the absense of one passed in: the
+ *    64 bit finalizer of MurmurHash3, reduced onto the key space with
+ *    fastrange. It mixes all 64 bits of the key into all 64 bits of the hash,
+ *    and shares nothing with hash_wang64, so the two rings of CuckooRings
+ *    place a key independently.
+   * @param key the number that being hashed
+   * @param kss_ the key space size
+   * @returns a hash between 0 and kss_
+   * Source: Austin Appleby, https://github.com/aappleby/smhasher (fmix64)
+ */
+inline long long hashstd(long long key, long long kss_) {
+  uint64_t h = (uint64_t) key;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return fastrange(h, kss_);
+}
+
+/**
+ * @brief Thomas Wang's 64 bit hash, reduced onto the key space with fastrange
+ * @param a the number that being hashed
+ * @param kss_ the key space size
+ * @returns a hash between 0 and kss_
+ * Source: Thomas Wang via Geoffrey Irving, https://naml.us/blog/tag/thomas-wang
+ */
+inline long long hash_wang64(long long a, long long kss_) {
+  uint64_t key = (uint64_t) a;
+  key = (~key) + (key << 21); // key = (key << 21) - key - 1;
+  key = key ^ (key >> 24);
+  key = (key + (key << 3)) + (key << 8); // key * 265
+  key = key ^ (key >> 14);
+  key = (key + (key << 2)) + (key << 4); // key * 21
+  key = key ^ (key >> 28);
+  key = key + (key << 31);
+  return fastrange(key, kss_);
+}
+
+#endif
@@ -0,0 +1,110 @@
+/*
+ *  Tests how evenly requests are spread over the servers when a few keys get most
+ *  of them. Insert 50000 keys into CuckooRings with 10000 servers per ring, then
+ *  send 4000000 requests with Zipf(ZIPF_S) popularity, once balancing by key count
+ *  and sending every request to where its key sits, and once tracking hot keys,
+ *  with a rebalance_weighted after the first half of the requests and the requests
+ *  for a hot key spread evenly over the two servers route names, as a caller
+ *  keeping a copy on the second would. Track the most requests any server got in
+ *  the second half against the mean, the p99 and p99.9 server, the max load in
+ *  keys, and the time per request.
+ * @author Ankit Gupta
+ * @author Jonah Kallenbach
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <time.h>
+#include <stdlib.h>
+
+#include "cuckoorings.hpp"
+
+using namespace std;
+
+#define KEYS 50000
+#define SERVERS 10000
+#define REQUESTS 4000000
+#define ZIPF_S 0.99
+#define SKETCH_WIDTH (1 << 16)
+
+int main ()
+{
+  // initialize variables and seed the random number generator
+  srand (time(NULL));
+  vector<int> keys;
+  for (int i = 1; i <= KEYS; ++i) {
+    keys.push_back(i);
+  }
+  random_shuffle(keys.begin(), keys.end());
+
+  // the popularity rank of a request, drawn from the Zipf distribution
+  vector<double> cdf(KEYS);
+  double sum = 0;
+  for (int i = 0; i < KEYS; ++i) {
+    sum += 1 / pow(i + 1, ZIPF_S);
+    cdf[i] = sum;
+  }
+  vector<int> requests(REQUESTS);
+  for (auto& r : requests) {
+    double u = sum * rand() / ((double) RAND_MAX + 1);
+    r = keys[lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin()];
+  }
+
+  for (int skew_aware = 0; skew_aware < 2; ++skew_aware) {
+    CuckooRings c((1L << 32), SERVERS);
+    if (skew_aware) {
+      c.track_hot_keys(SKETCH_WIDTH);
+    }
+    for (const auto& k : keys) {
+      c.insert(k);
+    }
+
+    unordered_map<unsigned long long, long long> served;
+    long long moved = 0;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < REQUESTS; ++i) {
+      if (i == REQUESTS / 2) {
+        served.clear();
+        if (skew_aware) {
+          moved = c.rebalance_weighted();
+        }
+      }
+      Placement p;
+      if (skew_aware) {
+        vector<Placement> servers = c.route(requests[i]);
+        p = servers[i % servers.size()];
+      }
+      else {
+        p = c.locate(requests[i]);
+      }
+      ++served[((unsigned long long) p.server << 1) | p.side];
+    }
+    double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / REQUESTS;
+
+    vector<long long> loads(c.getNumServers(), 0);
+    size_t n = 0;
+    for (const auto& s : served) {
+      loads[n++] = s.second;
+    }
+    sort(loads.begin(), loads.end());
+    double mean = (double) (REQUESTS - REQUESTS / 2) / c.getNumServers();
+    cout << (skew_aware ? "Balanced by weight, hot keys on both servers" : "Balanced by key count") << endl;
+    cout << "    Most requests on a server: " << loads.back() << " (" << loads.back() / mean
+         << "x the mean)" << endl;
+    cout << "    Requests on the p99/p99.9 server: " << loads[loads.size() * 99 / 100] << "/"
+         << loads[loads.size() * 999 / 1000] << endl;
+    cout << "    Max load (keys): " << c.get_max_load() << endl;
+    cout << "    Time per request (ns): " << ns << endl;
+    if (skew_aware) {
+      cout << "    Hot keys: " << c.num_hot_keys() << endl;
+      cout << "    Keys moved by rebalance_weighted: " << moved << endl;
+    }
+  }
+
+  return 0;
+}
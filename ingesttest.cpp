@@ -0,0 +1,116 @@
+/*
+ *  Tests ingest throughput with and without write-combining insert buffers.
+ *  Insert 2000000 random keys into a RingHash with 100000 servers, first on one
+ *  thread with a call to insert per key and with insert_batch on BATCH keys at a
+ *  time, then on 1, 2 and 4 threads sharing the ring, once with every insert
+ *  taking a lock on the ring and once through a WriteCombiner that flushes on
+ *  read. Track the keys inserted per second, and check that every key is there.
+ * @author Ankit Gupta
+ * @author Jonah Kallenbach
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <time.h>
+#include <assert.h>
+#include <stdlib.h>
+
+#include "ringhash.hpp"
+#include "writecombiner.hpp"
+
+using namespace std;
+
+#define KEYS 2000000
+#define SERVERS 100000
+#define BATCH 32768
+
+double since(chrono::steady_clock::time_point start) {
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void check(RingHash& r, const vector<int>& keys) {
+  for (size_t i = 0; i < keys.size(); i += 101) {
+    assert(r.contains(keys[i]));
+  }
+}
+
+int main ()
+{
+  // initialize variables and seed the random number generator
+  srand (time(NULL));
+  vector<int> keys(KEYS);
+  for (auto& k : keys) {
+    k = rand();
+  }
+
+  cout << "One thread" << endl;
+  {
+    RingHash r((1L << 32), SERVERS);
+    auto start = chrono::steady_clock::now();
+    for (const auto& k : keys) {
+      r.insert(k);
+    }
+    cout << "    insert: " << KEYS / since(start) << " keys/sec" << endl;
+    check(r, keys);
+  }
+  {
+    RingHash r((1L << 32), SERVERS);
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < keys.size(); i += BATCH) {
+      r.insert_batch(vector<int>(keys.begin() + i, keys.begin() + min(keys.size(), i + BATCH)));
+    }
+    cout << "    insert_batch of " << BATCH << ": " << KEYS / since(start) << " keys/sec" << endl;
+    check(r, keys);
+  }
+
+  for (int threads = 1; threads <= 4; threads *= 2) {
+    cout << threads << " thread(s)" << endl;
+    size_t share = KEYS / threads;
+    {
+      RingHash r((1L << 32), SERVERS);
+      mutex lock;
+      vector<thread> workers;
+      auto start = chrono::steady_clock::now();
+      for (int t = 0; t < threads; ++t) {
+        workers.push_back(thread([&, t] {
+          for (size_t i = t * share; i < (t + 1) * share; ++i) {
+            lock_guard<mutex> guard(lock);
+            r.insert(keys[i]);
+          }
+        }));
+      }
+      for (auto& w : workers) {
+        w.join();
+      }
+      cout << "    locked insert: " << KEYS / since(start) << " keys/sec" << endl;
+      check(r, keys);
+    }
+    {
+      RingHash r((1L << 32), SERVERS);
+      WriteCombiner<RingHash> combiner(r, BATCH, FLUSH_ON_READ);
+      vector<thread> workers;
+      auto start = chrono::steady_clock::now();
+      for (int t = 0; t < threads; ++t) {
+        workers.push_back(thread([&, t] {
+          WriteCombiner<RingHash>::Writer w = combiner.writer();
+          for (size_t i = t * share; i < (t + 1) * share; ++i) {
+            w.insert(keys[i]);
+          }
+        }));
+      }
+      for (auto& w : workers) {
+        w.join();
+      }
+      combiner.flush();
+      cout << "    write-combined insert: " << KEYS / since(start) << " keys/sec, "
+           << combiner.merges() << " merges" << endl;
+      combiner.read([&keys](RingHash& ring) { check(ring, keys); return 0; });
+    }
+  }
+
+  return 0;
+}
@@ -1,5 +1,6 @@
 /*
  * Tests speed benefits of adding keys 
+ * The memory each structure uses, with bytes per key and per server, goes to stderr.
  * @author Jonah Kallenbach
  * @author Ankit Gupta
  *
@@ -15,6 +16,7 @@
 #include <stdlib.h>
 
 #include "cuckoorings.hpp"
+#include "perfcounters.hpp"
 
 using namespace std;
 
@@ -23,6 +25,7 @@ int main ()
   // initialize variables and seed the random number generator
   clock_t t1, t2, t3;
   srand (time(NULL));
+  PerfCounters perf;
   int i, j;
 
   // repeat the experiment several times
@@ -35,31 +38,39 @@ int main ()
 
       // begin timing the RingHash
       t1 = clock();
+      perf.start();
 
       // make the insertions
       for (i = 1; i <= j; ++i) {
         r.insert(i);
       }
+      perf.stop();
       t2 = clock();
 
       // print statistics
       cout << ((float)(t2-t1))/CLOCKS_PER_SEC << ",";
       cout << ((float) r.cost_of_structure()) / r.getNumServers() << ",";
       cout << r.get_max_load() << endl;
+      perf.report("RingHash insert", j);
+      r.memory_usage().report("RingHash memory");
 
       // reset the clock
       t1 = clock();
+      perf.start();
 
       // make the insertions into the CuckooRings
       for (i = 1; i <= j; ++i) {
         c.insert(i);
       }
+      perf.stop();
       t2 = clock();
 
       // print statistics
       cout << ((float)(t2-t1))/CLOCKS_PER_SEC << ",";
       cout << ((float) c.cost_of_structure()) / c.getNumServers() << ",";
       cout << c.get_max_load() << endl;  
+      perf.report("CuckooRings insert", j);
+      c.memory_usage().report("CuckooRings memory");
     }
   }
 
@@ -0,0 +1,103 @@
+/*
+ *  Tests lazy server removal.
+ *  Add 100000 items to two RingHashes with 20000 servers each, and remove the same 2000
+ *  servers from both, lazily from the first and with remove_server from the second. The
+ *  load statistics of the two should agree at every step: right after the removals,
+ *  after looking up half of the keys, which moves the ones it finds on dead servers, and
+ *  after sweeping the rest. Then add 100000 items to CuckooRings with 20000 servers per
+ *  ring, remove 1000 servers from each ring lazily, look up half of the keys and sweep
+ *  the rest, and check that no key is lost and that no server is left over
+ *  SERVER_THRESHOLD.
+ * @author Ankit Gupta
+ * @author Jonah Kallenbach
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <assert.h>
+#include <stdlib.h>
+
+#include "cuckoorings.hpp"
+
+using namespace std;
+
+#define KEYS 100000
+#define SERVERS 20000
+#define REMOVES 2000
+
+/**
+ * @brief Checks that a lazily changed ring reports the same statistics as
+ *    one changed eagerly
+ */
+void compare(const string& step, RingHash& lazy, RingHash& eager) {
+  assert(lazy.size() == eager.size());
+  assert(lazy.getNumServers() == eager.getNumServers());
+  assert(lazy.getNumKeys() == eager.getNumKeys());
+  assert(lazy.get_max_load() == eager.get_max_load());
+  assert(lazy.get_min_load() == eager.get_min_load());
+  assert(lazy.cost_of_structure() == eager.cost_of_structure());
+  assert(lazy.get_avg_load() == eager.get_avg_load());
+  assert(lazy.get_variance_load() == eager.get_variance_load());
+  cout << "    " << step << ": " << lazy.num_dead_servers() << " dead servers, max load "
+       << lazy.get_max_load() << ", cost " << lazy.cost_of_structure() << endl;
+}
+
+int main ()
+{
+  // initialize variables and seed the random number generator
+  srand (time(NULL));
+
+  RingHash lazy((1L << 32), SERVERS);
+  RingHash eager((1L << 32), SERVERS);
+  for (int i = 1; i <= KEYS; ++i) {
+    lazy.insert(i);
+    eager.insert(i);
+  }
+  cout << "RingHash" << endl;
+  for (int i = 0; i < REMOVES; ++i) {
+    long long s = lazy.random_server();
+    lazy.remove_server_lazy(s);
+    eager.remove_server(s);
+  }
+  compare("Removed " + to_string(REMOVES) + " servers", lazy, eager);
+  for (int i = 1; i <= KEYS; i += 2) {
+    assert(lazy.lookup(i) == eager.lookup(i));
+  }
+  compare("Looked up half of the keys", lazy, eager);
+  lazy.sweep(LLONG_MAX);
+  assert(lazy.num_dead_servers() == 0);
+  compare("Swept", lazy, eager);
+  for (int i = 1; i <= KEYS; ++i) {
+    assert(lazy.contains(i) && lazy.lookup(i) == eager.lookup(i));
+  }
+
+  CuckooRings c((1L << 32), SERVERS);
+  for (int i = 1; i <= KEYS; ++i) {
+    c.insert(i);
+  }
+  long long servers = c.getNumServers();
+  for (int i = 0; i < REMOVES; ++i) {
+    c.remove_random_server_lazy(i % 2);
+  }
+  assert(c.getNumServers() == servers - REMOVES);
+  assert(c.getNumKeys() == KEYS);
+  cout << "CuckooRings" << endl;
+  cout << "    Removed " << REMOVES << " servers: max load " << c.get_max_load() << endl;
+  for (int i = 1; i <= KEYS; i += 2) {
+    c.locate(i);
+  }
+  assert(c.getNumKeys() == KEYS);
+  cout << "    Looked up half of the keys: max load " << c.get_max_load() << endl;
+  long long moved = c.sweep(LLONG_MAX);
+  assert(c.getNumKeys() == KEYS);
+  for (int i = 1; i <= KEYS; ++i) {
+    assert(c.contains(i));
+  }
+  assert(c.get_max_load() <= SERVER_THRESHOLD);
+  cout << "    Swept " << moved << " keys: max load " << c.get_max_load()
+       << ", cost " << c.cost_of_structure() << ", no keys lost" << endl;
+
+  return 0;
+}
@@ -0,0 +1,182 @@
+/*
+ *  A load generator for lookupd.
+ *  Inserts KEYS keys, then sends frames of random lookups, keeping a number of
+ *  frames in flight on the connection at once, and reports the latency of each
+ *  frame and the throughput in keys per second. Running it with a pipeline
+ *  depth and batch size of 1 gives the cost of one request per round trip.
+ *
+ *  Usage: lookupbench <socket path|tcp port> [frames] [pipeline depth] [batch size]
+ * @author Ankit Gupta
+ * @author Jonah Kallenbach
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "lookupproto.hpp"
+
+using namespace std;
+
+#define KEYS 1000000
+
+int connect_to(const string& address) {
+  int fd;
+  if (address.find('/') != string::npos) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, address.c_str(), sizeof(addr.sun_path) - 1);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+      close(fd);
+      return -1;
+    }
+  }
+  else {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(atoi(address.c_str()));
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+      close(fd);
+      return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  return fd;
+}
+
+/**
+ * @brief Writes everything queued in a buffer
+ */
+void send_all(int fd, LookupBuffer& out) {
+  while (out.size() > 0) {
+    ssize_t n = write(fd, out.data(), out.size());
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      perror("write");
+      exit(1);
+    }
+    out.consume(n);
+  }
+}
+
+/**
+ * @brief Reads until at least one whole response is buffered
+ */
+const LookupResponse* receive(int fd, LookupBuffer& in) {
+  const LookupResponse* rep;
+  while ((rep = next_response(in)) == NULL) {
+    char* p = in.reserve(65536);
+    ssize_t n = read(fd, p, in.room());
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      if (n < 0) {
+        perror("read");
+      }
+      else {
+        cerr << "lookupd closed the connection" << endl;
+      }
+      exit(1);
+    }
+    in.commit(n);
+  }
+  return rep;
+}
+
+int main (int argc, char** argv)
+{
+  if (argc < 2) {
+    cerr << "Usage: " << argv[0] << " <socket path|tcp port> [frames] [pipeline depth] [batch size]" << endl;
+    return 1;
+  }
+  long long frames = argc > 2 ? atoll(argv[2]) : 100000;
+  int depth = argc > 3 ? atoi(argv[3]) : 16;
+  int batch = argc > 4 ? atoi(argv[4]) : 16;
+  if (depth <= 0 || batch <= 0 || batch > LOOKUP_MAX_BATCH) {
+    cerr << "The pipeline depth has to be positive and the batch size from 1 to "
+         << LOOKUP_MAX_BATCH << endl;
+    return 1;
+  }
+  srand (time(NULL));
+
+  int fd = connect_to(argv[1]);
+  if (fd < 0) {
+    cerr << "Could not connect to " << argv[1] << endl;
+    return 1;
+  }
+  LookupBuffer in, out;
+  vector<int64_t> keys(LOOKUP_MAX_BATCH);
+
+  // load the keys, a full frame at a time
+  for (int i = 1; i <= KEYS; i += LOOKUP_MAX_BATCH) {
+    uint32_t count = min(LOOKUP_MAX_BATCH, KEYS - i + 1);
+    for (uint32_t j = 0; j < count; ++j) {
+      keys[j] = i + j;
+    }
+    write_request(out, LOOKUP_OP_INSERT, 0, &keys[0], count);
+    send_all(fd, out);
+    in.consume(response_size(receive(fd, in)));
+  }
+
+  // keep depth frames in flight, recording when each one was sent
+  vector<chrono::steady_clock::time_point> sent(depth);
+  vector<double> latencies;
+  latencies.reserve(frames);
+  long long next = 0, errors = 0;
+  auto start = chrono::steady_clock::now();
+  while ((long long) latencies.size() < frames) {
+    while (next < frames && next - (long long) latencies.size() < depth) {
+      for (int j = 0; j < batch; ++j) {
+        keys[j] = rand() % KEYS + 1;
+      }
+      write_request(out, LOOKUP_OP_LOOKUP, next, &keys[0], batch);
+      sent[next % depth] = chrono::steady_clock::now();
+      ++next;
+    }
+    send_all(fd, out);
+
+    const LookupResponse* rep = receive(fd, in);
+    auto now = chrono::steady_clock::now();
+    // frames are answered in order
+    assert((long long) rep->id == (long long) latencies.size() && (int) rep->count == batch);
+    const LookupResult* res = (const LookupResult*) (rep + 1);
+    for (uint32_t j = 0; j < rep->count; ++j) {
+      errors += res[j].status != 0;
+    }
+    latencies.push_back(chrono::duration<double, micro>(now - sent[rep->id % depth]).count());
+    in.consume(response_size(rep));
+  }
+  double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  close(fd);
+
+  sort(latencies.begin(), latencies.end());
+  cout << "Frames: " << frames << ", pipeline depth: " << depth << ", batch size: " << batch << endl;
+  cout << "    Time elapsed (sec): " << elapsed << endl;
+  cout << "    QPS (keys/sec): " << frames * batch / elapsed << endl;
+  cout << "    Frames/sec: " << frames / elapsed << endl;
+  cout << "    Frame latency p50/p99/p999 (us): " << latencies[frames / 2] << "/"
+       << latencies[frames * 99 / 100] << "/" << latencies[frames * 999 / 1000] << endl;
+  cout << "    Errors: " << errors << endl;
+  return 0;
+}
@@ -0,0 +1,178 @@
+/** @class LookupCache
+ * @brief A bounded, direct-mapped cache from keys to the result of a lookup.
+ * Each entry is tagged with the generation of the ring it was filled from;
+ * the ring bumps its generation on every membership change, which drops
+ * every entry at once, and single keys can be dropped with invalidate.
+ *
+ * Entries are 32 bytes and the table is aligned to a cache line, so a probe
+ * reads exactly one cache line.
+ *
+ * @author ankitvgupta
+ * @author jonahkall
+ */
+#ifndef LOOKUPCACHE_HPP
+#define LOOKUPCACHE_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+template <typename Value>
+class LookupCache {
+private:
+  struct Entry {
+    long long key;
+    unsigned long long generation;
+    Value value;
+  };
+
+  union Slot {
+    Entry entry;
+    char pad[32];
+  };
+  static_assert(sizeof(Entry) <= 32, "LookupCache values must fit in 16 bytes");
+
+  /**
+   * The slots live in storage_ starting at its first 64 byte boundary
+   */
+  std::vector<char> storage_;
+  size_t mask_;
+  int shift_;
+
+  long long hits_;
+  long long misses_;
+
+  Slot* slots(void) {
+    return (Slot*) (((uintptr_t) storage_.data() + 63) & ~(uintptr_t) 63);
+  }
+
+  Slot& slot_of(long long key) {
+    return slots()[((unsigned long long) key * 0x9e3779b97f4a7c15ULL) >> shift_];
+  }
+
+public:
+  /**
+   * Constructor for an empty LookupCache, which caches nothing
+   */
+  LookupCache() : mask_(0), shift_(64), hits_(0), misses_(0) {}
+
+  /**
+   * Constructor for a LookupCache
+   * @param entries the number of entries, rounded up to a power of 2
+   */
+  LookupCache(size_t entries) : hits_(0), misses_(0) {
+    size_t sz = 1;
+    shift_ = 64;
+    while (sz < entries) {
+      sz <<= 1;
+      --shift_;
+    }
+    // a shift of 64 is undefined, so a one entry cache uses two
+    if (shift_ == 64) {
+      sz = 2;
+      shift_ = 63;
+    }
+    mask_ = sz - 1;
+    storage_.resize(sz * sizeof(Slot) + 63);
+    // generation 0 is never used by a ring, so every slot starts out empty
+    for (size_t i = 0; i < sz; ++i) {
+      slots()[i].entry.generation = 0;
+    }
+  }
+
+  /**
+   * Copying has to move the slots to the new table's cache line boundary
+   */
+  LookupCache(const LookupCache& other) : storage_(other.storage_.size()),
+      mask_(other.mask_), shift_(other.shift_), hits_(other.hits_),
+      misses_(other.misses_) {
+    if (other.enabled()) {
+      memcpy(slots(), const_cast<LookupCache&>(other).slots(), size() * sizeof(Slot));
+    }
+  }
+
+  LookupCache& operator=(const LookupCache& other) {
+    if (this != &other) {
+      LookupCache copy(other);
+      storage_.swap(copy.storage_);
+      mask_ = copy.mask_;
+      shift_ = copy.shift_;
+      hits_ = copy.hits_;
+      misses_ = copy.misses_;
+    }
+    return *this;
+  }
+
+  /**
+   * @brief Whether the cache has any entries at all
+   */
+  bool enabled(void) const {
+    return !storage_.empty();
+  }
+
+  /**
+   * @brief Looks a key up in the cache
+   * @param generation the current generation of the ring
+   * @param value set to the cached value on a hit
+   * @returns whether the key was cached for this generation
+   */
+  bool probe(long long key, unsigned long long generation, Value* value) {
+    const Entry& e = slot_of(key).entry;
+    if (e.key == key && e.generation == generation) {
+      ++hits_;
+      *value = e.value;
+      return true;
+    }
+    ++misses_;
+    return false;
+  }
+
+  /**
+   * @brief Caches the value of a key, replacing whatever was in its slot
+   */
+  void fill(long long key, unsigned long long generation, const Value& value) {
+    Entry& e = slot_of(key).entry;
+    e.key = key;
+    e.generation = generation;
+    e.value = value;
+  }
+
+  /**
+   * @brief Drops a single key from the cache
+   */
+  void invalidate(long long key) {
+    Entry& e = slot_of(key).entry;
+    if (e.key == key) {
+      e.generation = 0;
+    }
+  }
+
+  /**
+   * @brief The number of entries in the cache
+   */
+  size_t size(void) const {
+    return mask_ + 1;
+  }
+
+  /**
+   * @brief The memory the table takes, in bytes
+   */
+  size_t bytes(void) const {
+    return storage_.capacity();
+  }
+
+  long long hits(void) const {
+    return hits_;
+  }
+
+  long long misses(void) const {
+    return misses_;
+  }
+
+  void reset_counters(void) {
+    hits_ = 0;
+    misses_ = 0;
+  }
+};
+
+#endif
@@ -0,0 +1,158 @@
+/*
+ *  Tests that the lookup cache never answers with a stale server.
+ *  Put a lookup cache in front of a RingHash and a CuckooRings, fill it by looking up
+ *  every key, then change the structure and look every key up again, checking each
+ *  answer against lookup_n, which never reads the cache. The changes on CuckooRings
+ *  are inserts that cascade, an insert_batch that relieves servers by moving single
+ *  keys, rebalance_optimal, rebalance_weighted with hot key tracking on, the
+ *  background rebalancer, lazy removals with a sweep, and a batch of membership
+ *  changes. On the RingHash they are added servers, removed servers and lazy removals
+ *  with a sweep. Also check that every lookup is counted as exactly one hit or miss,
+ *  and that a pass with nothing changed is answered from the cache.
+ * @author Ankit Gupta
+ * @author Jonah Kallenbach
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <time.h>
+#include <assert.h>
+#include <stdlib.h>
+
+#include "cuckoorings.hpp"
+
+using namespace std;
+
+#define KEYS 100000
+#define SERVERS 10000
+#define CACHE_ENTRIES (4 * KEYS)
+
+/**
+ * @brief Looks every key up through the cache and checks it against lookup_n
+ * @returns the number of lookups answered by the cache
+ */
+long long check(const string& step, CuckooRings& c, int keys) {
+  long long hits = c.lookup_cache_hits(), misses = c.lookup_cache_misses();
+  for (int k = 1; k <= keys; ++k) {
+    Placement p = c.locate(k);
+    Placement truth = c.lookup_n(k, 1)[0];
+    assert(p.side == truth.side && p.server == truth.server);
+  }
+  hits = c.lookup_cache_hits() - hits;
+  misses = c.lookup_cache_misses() - misses;
+  assert(hits + misses == keys);
+  cout << "    " << step << ": " << hits << " hits, " << misses << " misses" << endl;
+  return hits;
+}
+
+long long check(const string& step, RingHash& r, int keys) {
+  long long hits = r.lookup_cache_hits(), misses = r.lookup_cache_misses();
+  for (int k = 1; k <= keys; ++k) {
+    assert(r.lookup(k) == r.lookup_n(k, 1)[0]);
+  }
+  hits = r.lookup_cache_hits() - hits;
+  misses = r.lookup_cache_misses() - misses;
+  assert(hits + misses == keys);
+  cout << "    " << step << ": " << hits << " hits, " << misses << " misses" << endl;
+  return hits;
+}
+
+int main ()
+{
+  // initialize variables and seed the random number generator
+  srand (time(NULL));
+  int keys = KEYS / 2;
+
+  CuckooRings c((1L << 32), SERVERS);
+  c.enable_lookup_cache(CACHE_ENTRIES);
+  cout << "CuckooRings" << endl;
+  for (int k = 1; k <= keys; ++k) {
+    c.insert(k);
+  }
+  check("Filled", c, keys);
+  assert(check("Nothing changed", c, keys) > keys * 9 / 10);
+
+  for (int k = keys + 1; k <= keys + KEYS / 4; ++k) {
+    c.insert(k);
+  }
+  keys += KEYS / 4;
+  check("Inserts", c, keys);
+
+  vector<int> batch;
+  for (int k = keys + 1; k <= KEYS; ++k) {
+    batch.push_back(k);
+  }
+  c.insert_batch(batch);
+  keys = KEYS;
+  check("insert_batch", c, keys);
+
+  long long moved = c.rebalance_optimal();
+  check("rebalance_optimal, " + to_string(moved) + " keys moved", c, keys);
+
+  c.track_hot_keys(1 << 16);
+  for (int i = 0; i < 20; ++i) {
+    for (int k = 1; k <= 100; ++k) {
+      c.locate(k);
+    }
+  }
+  moved = c.rebalance_weighted();
+  check("rebalance_weighted, " + to_string(moved) + " keys moved", c, keys);
+  c.track_hot_keys(0);
+
+  c.start_rebalancer(1e6);
+  for (int side = 0; side < 2; ++side) {
+    vector<long long> gone;
+    for (int i = 0; i < 200; ++i) {
+      gone.push_back(c.random_server(side));
+    }
+    c.apply_membership_changes(vector<long long>(), gone, side);
+  }
+  while (c.rebalancer_pending() > 0) {
+    this_thread::sleep_for(chrono::milliseconds(1));
+  }
+  c.stop_rebalancer();
+  check("Background rebalancer", c, keys);
+
+  for (int i = 0; i < 500; ++i) {
+    c.remove_random_server_lazy(i % 2);
+  }
+  check("Lazy removals", c, keys);
+  c.sweep(LLONG_MAX);
+  check("Sweep", c, keys);
+
+  vector<long long> adds, removes;
+  for (int i = 0; i < 100; ++i) {
+    adds.push_back(((long long) rand() << 31 ^ rand()) % (1L << 32));
+    removes.push_back(c.random_server(1));
+  }
+  c.apply_membership_changes(adds, removes, 1);
+  check("Membership changes", c, keys);
+
+  RingHash r((1L << 32), SERVERS);
+  r.enable_lookup_cache(CACHE_ENTRIES);
+  cout << "RingHash" << endl;
+  for (int k = 1; k <= KEYS; ++k) {
+    r.insert(k);
+  }
+  check("Filled", r, KEYS);
+  assert(check("Nothing changed", r, KEYS) > KEYS * 9 / 10);
+  for (int i = 0; i < 100; ++i) {
+    r.add_random_server();
+  }
+  check("Added servers", r, KEYS);
+  for (int i = 0; i < 100; ++i) {
+    r.remove_random_server();
+  }
+  check("Removed servers", r, KEYS);
+  for (int i = 0; i < 500; ++i) {
+    r.remove_server_lazy(r.random_server());
+  }
+  check("Lazy removals", r, KEYS);
+  r.sweep(LLONG_MAX);
+  check("Sweep", r, KEYS);
+
+  return 0;
+}
@@ -0,0 +1,289 @@
+/*
+ *  A lookup daemon serving a RingHash or a CuckooRings over a Unix socket or a
+ *  localhost TCP port, using the protocol in lookupproto.hpp.
+ *  A single thread runs an epoll loop over every connection. Each readable
+ *  connection is drained, every complete frame in its buffer is answered
+ *  straight into its output buffer, and the output is written back in as few
+ *  calls as the socket allows, so pipelined and batched requests share the
+ *  cost of each system call.
+ *
+ *  Given a metrics port, it also serves the health of the ring over HTTP on
+ *  127.0.0.1, at /metrics for Prometheus and /metrics.json, refreshed once a second.
+ *
+ *  Usage: lookupd <ring|cuckoo> <socket path|tcp port> [servers] [metrics port]
+ * @author Ankit Gupta
+ * @author Jonah Kallenbach
+ */
+
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <chrono>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "cuckoorings.hpp"
+#include "lookupproto.hpp"
+
+using namespace std;
+
+#define MAX_EVENTS 64
+
+// How often the published metrics are refreshed, in milliseconds
+#define METRICS_PERIOD 1000
+
+struct Connection {
+  int fd;
+  LookupBuffer in;
+  LookupBuffer out;
+  bool writing;
+};
+
+void set_nonblocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+/**
+ * @brief Listens on a Unix socket if the address contains a '/', and on
+ *    127.0.0.1 otherwise
+ */
+int listen_on(const string& address) {
+  int fd;
+  if (address.find('/') != string::npos) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, address.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(address.c_str());
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+      close(fd);
+      return -1;
+    }
+  }
+  else {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(atoi(address.c_str()));
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+      close(fd);
+      return -1;
+    }
+  }
+  if (listen(fd, 128) < 0) {
+    close(fd);
+    return -1;
+  }
+  set_nonblocking(fd);
+  return fd;
+}
+
+void answer(RingHash& r, uint16_t op, int64_t key, LookupResult* res) {
+  if (op == LOOKUP_OP_INSERT) {
+    r.insert(key);
+  }
+  res->server = r.lookup(key);
+  res->side = 0;
+}
+
+void answer(CuckooRings& c, uint16_t op, int64_t key, LookupResult* res) {
+  if (op == LOOKUP_OP_INSERT) {
+    c.insert(key);
+  }
+  Placement p = c.locate(key);
+  res->server = p.server;
+  res->side = p.side;
+}
+
+void collect(RingHash& r, Metrics& out) {
+  r.metrics(out, Metrics::Labels());
+}
+
+void collect(CuckooRings& c, Metrics& out) {
+  c.metrics(out);
+}
+
+/**
+ * @brief Answers every complete frame in a connection's input buffer
+ * @returns false if a frame was too large, and the connection should close
+ */
+template <typename Ring>
+bool handle_frames(Ring& ring, Connection& conn) {
+  const LookupRequest* req;
+  while ((req = next_request(conn.in)) != NULL) {
+    if (req->count > LOOKUP_MAX_BATCH) {
+      return false;
+    }
+    size_t n = sizeof(LookupResponse) + req->count * sizeof(LookupResult);
+    char* p = conn.out.reserve(n);
+    LookupResponse* rep = (LookupResponse*) p;
+    LookupResult* res = (LookupResult*) (p + sizeof(LookupResponse));
+    const int64_t* keys = (const int64_t*) (req + 1);
+    rep->id = req->id;
+    rep->count = req->count;
+    bool known = req->op == LOOKUP_OP_LOOKUP || req->op == LOOKUP_OP_INSERT;
+    for (uint32_t i = 0; i < req->count; ++i) {
+      res[i].status = !known ? LOOKUP_BAD_OP :
+          keys[i] < INT_MIN || keys[i] > INT_MAX ? LOOKUP_BAD_KEY : LOOKUP_OK;
+      if (res[i].status == LOOKUP_OK) {
+        answer(ring, req->op, keys[i], &res[i]);
+      }
+      else {
+        res[i].server = -1;
+        res[i].side = -1;
+      }
+    }
+    conn.out.commit(n);
+    conn.in.consume(request_size(req));
+  }
+  return true;
+}
+
+/**
+ * @brief Writes as much of a connection's output as the socket will take
+ * @returns false if the connection failed
+ */
+bool flush(Connection& conn) {
+  while (conn.out.size() > 0) {
+    ssize_t n = write(conn.fd, conn.out.data(), conn.out.size());
+    if (n < 0) {
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    conn.out.consume(n);
+  }
+  return true;
+}
+
+template <typename Ring>
+void serve(Ring& ring, int listener, MetricsServer* metrics) {
+  int ep = epoll_create1(0);
+  struct epoll_event ev, events[MAX_EVENTS];
+  ev.events = EPOLLIN;
+  ev.data.fd = listener;
+  epoll_ctl(ep, EPOLL_CTL_ADD, listener, &ev);
+  unordered_map<int, Connection*> conns;
+  chrono::steady_clock::time_point published;
+
+  for (;;) {
+    // the ring is only touched from this thread, so the metrics are collected here
+    if (metrics && chrono::steady_clock::now() - published >= chrono::milliseconds(METRICS_PERIOD)) {
+      Metrics m;
+      collect(ring, m);
+      metrics->publish(m);
+      published = chrono::steady_clock::now();
+    }
+    int ready = epoll_wait(ep, events, MAX_EVENTS, metrics ? METRICS_PERIOD : -1);
+    for (int i = 0; i < ready; ++i) {
+      int fd = events[i].data.fd;
+      if (fd == listener) {
+        int c;
+        while ((c = accept(listener, NULL, NULL)) >= 0) {
+          set_nonblocking(c);
+          int one = 1;
+          setsockopt(c, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+          Connection* conn = new Connection();
+          conn->fd = c;
+          conn->writing = false;
+          conns[c] = conn;
+          ev.events = EPOLLIN;
+          ev.data.fd = c;
+          epoll_ctl(ep, EPOLL_CTL_ADD, c, &ev);
+        }
+        continue;
+      }
+
+      Connection& conn = *conns[fd];
+      bool ok = true;
+      if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        // drain the socket, answering frames as they complete
+        for (;;) {
+          char* p = conn.in.reserve(65536);
+          ssize_t n = read(fd, p, conn.in.room());
+          if (n > 0) {
+            conn.in.commit(n);
+            ok = handle_frames(ring, conn);
+            if (!ok) {
+              break;
+            }
+          }
+          else {
+            ok = n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+            break;
+          }
+        }
+      }
+      ok = ok && flush(conn);
+      if (!ok) {
+        epoll_ctl(ep, EPOLL_CTL_DEL, fd, NULL);
+        close(fd);
+        conns.erase(fd);
+        delete &conn;
+        continue;
+      }
+
+      // only wait for the socket to become writable while output is queued
+      bool writing = conn.out.size() > 0;
+      if (writing != conn.writing) {
+        conn.writing = writing;
+        ev.events = EPOLLIN | (writing ? (uint32_t) EPOLLOUT : 0);
+        ev.data.fd = fd;
+        epoll_ctl(ep, EPOLL_CTL_MOD, fd, &ev);
+      }
+    }
+  }
+}
+
+int main (int argc, char** argv)
+{
+  if (argc < 3) {
+    cerr << "Usage: " << argv[0] << " <ring|cuckoo> <socket path|tcp port> [servers] [metrics port]" << endl;
+    return 1;
+  }
+  string kind = argv[1];
+  long long servers = argc > 3 ? atoll(argv[3]) : 1000000;
+  signal(SIGPIPE, SIG_IGN);
+
+  int listener = listen_on(argv[2]);
+  if (listener < 0) {
+    cerr << "Could not listen on " << argv[2] << endl;
+    return 1;
+  }
+  cerr << "Serving " << kind << " with " << servers << " servers on " << argv[2] << endl;
+
+  MetricsServer* metrics = NULL;
+  if (argc > 4) {
+    metrics = new MetricsServer(atoi(argv[4]));
+    if (!metrics->ok()) {
+      cerr << "Could not serve metrics on port " << argv[4] << endl;
+      return 1;
+    }
+    cerr << "Metrics on http://127.0.0.1:" << metrics->port() << "/metrics" << endl;
+  }
+
+  if (kind == "cuckoo") {
+    CuckooRings c((1L << 32), servers / 2);
+    c.enable_lookup_index();
+    serve(c, listener, metrics);
+  }
+  else {
+    RingHash r((1L << 32), servers);
+    r.enable_lookup_index();
+    serve(r, listener, metrics);
+  }
+  return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ *  Tests replica placement with lookup_n.
+ *  Add 100000 items to a RingHash with 20000 servers and to CuckooRings with 10000
+ *  servers per ring, and remove 1000 servers lazily from each so that some lookups
+ *  start on dead servers. For 100000 random keys and each replica count from 1 to R,
+ *  check that lookup_n returns as many distinct servers as asked for, and that
+ *  the first is the one lookup and locate return. Track the time per lookup_n of R
+ *  servers.
+ * @author Ankit Gupta
+ * @author Jonah Kallenbach
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <set>
+#include <utility>
+#include <time.h>
+#include <assert.h>
+#include <stdlib.h>
+
+#include "cuckoorings.hpp"
+
+using namespace std;
+
+#define KEYS 100000
+#define SERVERS 20000
+#define REMOVES 1000
+#define LOOKUPS 100000
+#define R 5
+
+int main ()
+{
+  // initialize variables and seed the random number generator
+  clock_t t1, t2;
+  srand (time(NULL));
+  int i, r;
+
+  RingHash ring((1L << 32), SERVERS);
+  CuckooRings c((1L << 32), SERVERS / 2);
+  for (i = 1; i <= KEYS; ++i) {
+    ring.insert(i);
+    c.insert(i);
+  }
+  for (i = 0; i < REMOVES; ++i) {
+    ring.remove_server_lazy(ring.random_server());
+    c.remove_random_server_lazy(i % 2);
+  }
+  vector<int> keys;
+  for (i = 0; i < LOOKUPS; ++i) {
+    keys.push_back(rand() % (2 * KEYS) + 1);
+  }
+
+  for (r = 1; r <= R; ++r) {
+    for (const auto& key : keys) {
+      vector<long long> servers = ring.lookup_n(key, r);
+      assert((int) servers.size() == r);
+      assert(servers[0] == ring.lookup(key));
+      assert(set<long long>(servers.begin(), servers.end()).size() == servers.size());
+    }
+  }
+  vector<long long> out;
+  t1 = clock();
+  for (const auto& key : keys) {
+    ring.lookup_n(key, R, out);
+    out.clear();
+  }
+  t2 = clock();
+  cout << "RingHash" << endl;
+  cout << "    Time per lookup_n (us): " << 1e6 * ((float) (t2 - t1)) / CLOCKS_PER_SEC / LOOKUPS << endl;
+
+  for (r = 1; r <= R; ++r) {
+    for (const auto& key : keys) {
+      vector<Placement> servers = c.lookup_n(key, r);
+      Placement p = c.locate(key);
+      assert((int) servers.size() == r);
+      assert(servers[0].side == p.side && servers[0].server == p.server);
+      set<pair<int, long long> > seen;
+      for (size_t j = 0; j < servers.size(); ++j) {
+        // the two rings alternate, starting with the key's own
+        assert(servers[j].side == (j % 2 ? 1 - p.side : p.side));
+        seen.insert(make_pair(servers[j].side, servers[j].server));
+      }
+      assert(seen.size() == servers.size());
+    }
+  }
+  vector<Placement> placements;
+  t1 = clock();
+  for (const auto& key : keys) {
+    c.lookup_n(key, R, placements);
+    placements.clear();
+  }
+  t2 = clock();
+  cout << "CuckooRings" << endl;
+  cout << "    Time per lookup_n (us): " << 1e6 * ((float) (t2 - t1)) / CLOCKS_PER_SEC / LOOKUPS << endl;
+  cout << "All lookup_n results distinct and led by the key's own server" << endl;
+
+  return 0;
+}
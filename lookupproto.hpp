@@ -0,0 +1,186 @@
+/** @file lookupproto.hpp
+ * @brief The binary protocol spoken by lookupd and lookupbench.
+ * A request frame is a LookupRequest header followed by count 64 bit keys,
+ * and its response is a LookupResponse header followed by count
+ * LookupResults, in the same order. Frames carry an id so that a client can
+ * pipeline many of them on one connection; the daemon answers them in order.
+ * Everything is in host byte order, since both ends run on the same machine.
+ *
+ * Frames are parsed in place in a LookupBuffer and answered by writing
+ * straight into another, so a request is never copied on its way through.
+ *
+ * @author ankitvgupta
+ * @author jonahkall
+ */
+#ifndef LOOKUPPROTO_HPP
+#define LOOKUPPROTO_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+/**
+ * The most keys a single frame may carry
+ */
+#define LOOKUP_MAX_BATCH 4096
+
+enum LookupOp {
+  LOOKUP_OP_LOOKUP = 1,
+  LOOKUP_OP_INSERT = 2
+};
+
+struct LookupRequest {
+  uint16_t op;
+  uint16_t reserved;
+  uint32_t id;
+  uint32_t count;
+  uint32_t reserved2;
+};
+
+struct LookupResponse {
+  uint32_t id;
+  uint32_t count;
+};
+
+/**
+ * The status of a single result. The rings hold 32 bit keys, so a key
+ * outside that range is refused rather than truncated onto another key.
+ */
+enum LookupStatus {
+  LOOKUP_OK = 0,
+  LOOKUP_BAD_OP = 1,
+  LOOKUP_BAD_KEY = 2
+};
+
+/**
+ * Where a key lives. side is always 0 for a RingHash. On any status other
+ * than LOOKUP_OK, server and side are -1.
+ */
+struct LookupResult {
+  int64_t server;
+  int32_t side;
+  int32_t status;
+};
+
+/** @class LookupBuffer
+ * @brief A byte buffer that is filled at the back and drained from the front
+ */
+class LookupBuffer {
+private:
+  std::vector<char> data_;
+  size_t begin_;
+  size_t end_;
+
+public:
+  LookupBuffer() : data_(65536), begin_(0), end_(0) {}
+
+  /**
+   * @brief The bytes that have been written but not consumed
+   */
+  char* data(void) {
+    return &data_[begin_];
+  }
+
+  size_t size(void) const {
+    return end_ - begin_;
+  }
+
+  /**
+   * @brief Makes room for at least n more bytes at the back
+   * @returns where to write them, to be followed by a call to commit
+   */
+  char* reserve(size_t n) {
+    if (data_.size() - end_ < n) {
+      // move the unconsumed bytes to the front before growing
+      memmove(&data_[0], &data_[begin_], end_ - begin_);
+      end_ -= begin_;
+      begin_ = 0;
+      if (data_.size() - end_ < n) {
+        data_.resize(std::max(data_.size() * 2, end_ + n));
+      }
+    }
+    return &data_[end_];
+  }
+
+  /**
+   * @brief the number of bytes that can be written before reserve has to move anything
+   */
+  size_t room(void) const {
+    return data_.size() - end_;
+  }
+
+  void commit(size_t n) {
+    end_ += n;
+  }
+
+  void consume(size_t n) {
+    begin_ += n;
+    if (begin_ == end_) {
+      begin_ = end_ = 0;
+    }
+  }
+};
+
+/**
+ * @brief Finds the first complete request frame in a buffer
+ * @returns the frame, or NULL if more bytes are needed. Its keys follow it.
+ */
+inline const LookupRequest* next_request(LookupBuffer& in) {
+  if (in.size() < sizeof(LookupRequest)) {
+    return NULL;
+  }
+  const LookupRequest* req = (const LookupRequest*) in.data();
+  size_t count = req->count > LOOKUP_MAX_BATCH ? 0 : req->count;
+  if (in.size() < sizeof(LookupRequest) + count * sizeof(int64_t)) {
+    return NULL;
+  }
+  return req;
+}
+
+/**
+ * @brief the size of a request frame, including its keys
+ */
+inline size_t request_size(const LookupRequest* req) {
+  size_t count = req->count > LOOKUP_MAX_BATCH ? 0 : req->count;
+  return sizeof(LookupRequest) + count * sizeof(int64_t);
+}
+
+/**
+ * @brief Writes a request frame to the back of a buffer
+ */
+inline void write_request(LookupBuffer& out, uint16_t op, uint32_t id,
+    const int64_t* keys, uint32_t count) {
+  size_t n = sizeof(LookupRequest) + count * sizeof(int64_t);
+  char* p = out.reserve(n);
+  LookupRequest req;
+  req.op = op;
+  req.reserved = 0;
+  req.id = id;
+  req.count = count;
+  req.reserved2 = 0;
+  memcpy(p, &req, sizeof(req));
+  memcpy(p + sizeof(req), keys, count * sizeof(int64_t));
+  out.commit(n);
+}
+
+/**
+ * @brief Finds the first complete response frame in a buffer
+ * @returns the frame, or NULL if more bytes are needed. Its results follow it.
+ */
+inline const LookupResponse* next_response(LookupBuffer& in) {
+  if (in.size() < sizeof(LookupResponse)) {
+    return NULL;
+  }
+  const LookupResponse* rep = (const LookupResponse*) in.data();
+  if (in.size() < sizeof(LookupResponse) + rep->count * sizeof(LookupResult)) {
+    return NULL;
+  }
+  return rep;
+}
+
+inline size_t response_size(const LookupResponse* rep) {
+  return sizeof(LookupResponse) + rep->count * sizeof(LookupResult);
+}
+
+#endif
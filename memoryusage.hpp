@@ -0,0 +1,119 @@
+/** @class MemoryUsage
+ * @brief A breakdown of the memory a ring uses, in bytes, by component.
+ * The components add up to the total. Heap blocks are counted as glibc's
+ * malloc hands them out, with its 8 byte header and rounding to 16 bytes,
+ * and containers count the capacity they hold, not just what they use, so
+ * the numbers are close to what the process actually pays for.
+ *
+ * Slack is reported on its own: the bytes reserved for keys in buckets that
+ * hold no key. It is part of the components, not added to them.
+ *
+ * @author ankitvgupta
+ * @author jonahkall
+ */
+#ifndef MEMORYUSAGE_HPP
+#define MEMORYUSAGE_HPP
+
+#include <iostream>
+#include <map>
+#include <string>
+
+class MemoryUsage {
+public:
+  /**
+   * The bytes of each component, and the bytes of slack in them
+   */
+  std::map<std::string, size_t> bytes;
+  size_t slack;
+
+  /**
+   * The keys and live servers the memory holds, for the per key and per
+   * server figures
+   */
+  long long keys;
+  long long servers;
+
+  MemoryUsage() : slack(0), keys(0), servers(0) {}
+
+  /**
+   * @brief the size of the heap block malloc gives for a request of n bytes
+   */
+  static size_t heap_block(size_t n) {
+    return n + 8 <= 32 ? 32 : (n + 8 + 15) & ~(size_t) 15;
+  }
+
+  /**
+   * @brief the heap block of an array of n bytes, such as a vector's
+   *    storage, or 0 if it is empty and so never allocated
+   */
+  static size_t heap_array(size_t n) {
+    return n ? heap_block(n) : 0;
+  }
+
+  /**
+   * @brief the bytes a std::map or std::set with n entries of a value type
+   *    spends on its nodes, each a 32 byte tree header and the value
+   */
+  static size_t tree_nodes(size_t n, size_t value_size) {
+    return n * heap_block(32 + value_size);
+  }
+
+  /**
+   * @brief the bytes a std::unordered_map or std::unordered_set spends on
+   *    its bucket array and its nodes, each a next pointer and the value
+   */
+  static size_t hash_table(size_t n, size_t buckets, size_t value_size) {
+    return buckets * sizeof(void*) + n * heap_block(sizeof(void*) + value_size);
+  }
+
+  /**
+   * @brief Adds bytes to a component
+   */
+  void add(const std::string& component, size_t n) {
+    bytes[component] += n;
+  }
+
+  /**
+   * @brief Adds another breakdown to this one, with its components named
+   *    prefix + name
+   */
+  void add(const MemoryUsage& other, const std::string& prefix) {
+    for (const auto& b : other.bytes) {
+      bytes[prefix + b.first] += b.second;
+    }
+    slack += other.slack;
+    keys += other.keys;
+    servers += other.servers;
+  }
+
+  size_t total(void) const {
+    size_t sum = 0;
+    for (const auto& b : bytes) {
+      sum += b.second;
+    }
+    return sum;
+  }
+
+  double bytes_per_key(void) const {
+    return keys ? (double) total() / keys : 0;
+  }
+
+  double bytes_per_server(void) const {
+    return servers ? (double) total() / servers : 0;
+  }
+
+  /**
+   * @brief Prints the total, bytes per key and per server, slack and each
+   *    component on one line
+   */
+  void report(const std::string& label, std::ostream& out = std::cerr) const {
+    out << label << ": " << total() << " bytes, " << bytes_per_key() << " bytes/key, "
+        << bytes_per_server() << " bytes/server, slack=" << slack;
+    for (const auto& b : bytes) {
+      out << " " << b.first << "=" << b.second;
+    }
+    out << std::endl;
+  }
+};
+
+#endif
@@ -0,0 +1,386 @@
+/** @class Metrics
+ * @brief A set of named gauges, counters and histograms describing the
+ * health of a ring, written out as Prometheus text or as JSON. Each ring
+ * adds its own samples with labels that tell it apart from the others.
+ *
+ * A MetricsServer serves the last set of metrics published to it over HTTP
+ * on 127.0.0.1, at /metrics in Prometheus format and at /metrics.json. The
+ * rings are not thread safe, so the owner of a ring collects the metrics
+ * between operations and publishes them; the server thread only ever reads
+ * the published text.
+ *
+ * @author ankitvgupta
+ * @author jonahkall
+ */
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+class Metrics {
+public:
+  typedef std::map<std::string, std::string> Labels;
+
+private:
+  struct Sample {
+    Labels labels;
+    double value;
+    // for histograms, the number of observations of each value from 0 up
+    std::vector<long long> counts;
+  };
+
+  struct Family {
+    std::string name;
+    std::string help;
+    std::string type;
+    std::vector<Sample> samples;
+  };
+
+  std::vector<Family> families_;
+  std::map<std::string, size_t> by_name_;
+
+  Family& family(const std::string& name, const std::string& help, const std::string& type) {
+    std::map<std::string, size_t>::iterator it = by_name_.find(name);
+    if (it != by_name_.end()) {
+      return families_[it->second];
+    }
+    by_name_[name] = families_.size();
+    Family f;
+    f.name = name;
+    f.help = help;
+    f.type = type;
+    families_.push_back(f);
+    return families_.back();
+  }
+
+  static std::string escape(const std::string& s) {
+    std::string out;
+    for (const auto& c : s) {
+      if (c == '\\' || c == '"') {
+        out += '\\';
+      }
+      if (c == '\n') {
+        out += "\\n";
+      }
+      else {
+        out += c;
+      }
+    }
+    return out;
+  }
+
+  /**
+   * @brief Formats labels as {a="x",b="y"}, with an extra one at the end if given
+   */
+  static std::string prometheus_labels(const Labels& labels,
+      const std::string& extra = "", const std::string& extra_value = "") {
+    std::ostringstream out;
+    bool first = true;
+    for (const auto& l : labels) {
+      out << (first ? "{" : ",") << l.first << "=\"" << escape(l.second) << "\"";
+      first = false;
+    }
+    if (!extra.empty()) {
+      out << (first ? "{" : ",") << extra << "=\"" << extra_value << "\"";
+      first = false;
+    }
+    if (!first) {
+      out << "}";
+    }
+    return out.str();
+  }
+
+  static std::string number(double v) {
+    std::ostringstream out;
+    out.precision(17);
+    out << v;
+    return out.str();
+  }
+
+public:
+  /**
+   * @brief Adds a value that can go up and down
+   */
+  void gauge(const std::string& name, const std::string& help, const Labels& labels, double value) {
+    Sample s = { labels, value, std::vector<long long>() };
+    family(name, help, "gauge").samples.push_back(s);
+  }
+
+  /**
+   * @brief Adds a value that only goes up over the life of the ring
+   */
+  void counter(const std::string& name, const std::string& help, const Labels& labels, double value) {
+    Sample s = { labels, value, std::vector<long long>() };
+    family(name, help, "counter").samples.push_back(s);
+  }
+
+  /**
+   * @brief Adds a histogram of small whole numbers, such as server loads
+   * @param counts the number of observations of each value, from 0 up
+   */
+  void histogram(const std::string& name, const std::string& help, const Labels& labels,
+      const std::vector<long long>& counts) {
+    Sample s = { labels, 0, counts };
+    family(name, help, "histogram").samples.push_back(s);
+  }
+
+  /**
+   * @brief the metrics in the Prometheus text exposition format
+   */
+  std::string prometheus(void) const {
+    std::ostringstream out;
+    for (const auto& f : families_) {
+      out << "# HELP " << f.name << " " << f.help << "\n";
+      out << "# TYPE " << f.name << " " << f.type << "\n";
+      for (const auto& s : f.samples) {
+        if (f.type != "histogram") {
+          out << f.name << prometheus_labels(s.labels) << " " << number(s.value) << "\n";
+          continue;
+        }
+        long long count = 0, sum = 0;
+        for (size_t v = 0; v < s.counts.size(); ++v) {
+          count += s.counts[v];
+          sum += s.counts[v] * (long long) v;
+          out << f.name << "_bucket" << prometheus_labels(s.labels, "le", number(v))
+              << " " << count << "\n";
+        }
+        out << f.name << "_bucket" << prometheus_labels(s.labels, "le", "+Inf") << " " << count << "\n";
+        out << f.name << "_sum" << prometheus_labels(s.labels) << " " << sum << "\n";
+        out << f.name << "_count" << prometheus_labels(s.labels) << " " << count << "\n";
+      }
+    }
+    return out.str();
+  }
+
+  /**
+   * @brief the metrics as a JSON object from each name to its list of samples
+   */
+  std::string json(void) const {
+    std::ostringstream out;
+    out << "{";
+    for (size_t i = 0; i < families_.size(); ++i) {
+      const Family& f = families_[i];
+      out << (i ? "," : "") << "\"" << f.name << "\":{\"type\":\"" << f.type
+          << "\",\"help\":\"" << escape(f.help) << "\",\"samples\":[";
+      for (size_t j = 0; j < f.samples.size(); ++j) {
+        const Sample& s = f.samples[j];
+        out << (j ? "," : "") << "{\"labels\":{";
+        bool first = true;
+        for (const auto& l : s.labels) {
+          out << (first ? "" : ",") << "\"" << escape(l.first) << "\":\"" << escape(l.second) << "\"";
+          first = false;
+        }
+        out << "},";
+        if (f.type != "histogram") {
+          out << "\"value\":" << number(s.value) << "}";
+          continue;
+        }
+        out << "\"counts\":[";
+        for (size_t v = 0; v < s.counts.size(); ++v) {
+          out << (v ? "," : "") << s.counts[v];
+        }
+        out << "]}";
+      }
+      out << "]}";
+    }
+    out << "}\n";
+    return out.str();
+  }
+
+  /**
+   * @brief Writes the metrics to a file, as JSON if its name ends in .json
+   *    and in Prometheus format otherwise. The file is replaced in one step,
+   *    so a reader never sees half of it.
+   * @returns whether the file was written
+   */
+  bool write(const std::string& path) const {
+    bool as_json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+    std::string tmp = path + ".tmp";
+    {
+      std::ofstream out(tmp.c_str());
+      out << (as_json ? json() : prometheus());
+      if (!out) {
+        return false;
+      }
+    }
+    return rename(tmp.c_str(), path.c_str()) == 0;
+  }
+};
+
+// How long, in milliseconds, the metrics server waits on one client before
+// dropping it, so a client that stalls can't hold up the others
+#define METRICS_CLIENT_TIMEOUT_MS 1000
+
+// How long, in milliseconds, the metrics server waits before accepting again
+// after accept fails for want of file descriptors or memory
+#define METRICS_ACCEPT_BACKOFF_MS 100
+
+/** @class MetricsServer
+ * @brief Serves published metrics over HTTP on 127.0.0.1 from its own thread
+ */
+class MetricsServer {
+private:
+  struct Page {
+    std::string prometheus;
+    std::string json;
+  };
+
+  int fd_;
+  std::atomic<bool> stopping_;
+  std::shared_ptr<const Page> page_;
+  std::thread thread_;
+
+  static void send_all(int fd, const std::string& s) {
+    size_t sent = 0;
+    while (sent < s.size()) {
+      ssize_t n = ::send(fd, s.data() + sent, s.size() - sent, MSG_NOSIGNAL);
+      if (n <= 0) {
+        return;
+      }
+      sent += n;
+    }
+  }
+
+  void answer(int c) {
+    // every recv and send gives up after the timeout, and the request as a
+    // whole has to arrive within it too
+    struct timeval tv;
+    tv.tv_sec = METRICS_CLIENT_TIMEOUT_MS / 1000;
+    tv.tv_usec = (METRICS_CLIENT_TIMEOUT_MS % 1000) * 1000;
+    setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(c, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+        std::chrono::milliseconds(METRICS_CLIENT_TIMEOUT_MS);
+    // only the request line matters
+    char buf[1024];
+    size_t got = 0;
+    while (got < sizeof(buf) - 1 && memchr(buf, '\n', got) == NULL) {
+      ssize_t n = recv(c, buf + got, sizeof(buf) - 1 - got, 0);
+      if (n <= 0 || std::chrono::steady_clock::now() > deadline) {
+        return;
+      }
+      got += n;
+    }
+    std::string line(buf, got);
+    line = line.substr(0, line.find_first_of("\r\n"));
+    std::shared_ptr<const Page> page = std::atomic_load(&page_);
+    std::string status = "200 OK", type, body;
+    if (line.compare(0, 18, "GET /metrics.json ") == 0) {
+      type = "application/json";
+      body = page ? page->json : "{}\n";
+    }
+    else if (line.compare(0, 13, "GET /metrics ") == 0) {
+      type = "text/plain; version=0.0.4";
+      body = page ? page->prometheus : "";
+    }
+    else {
+      status = "404 Not Found";
+      type = "text/plain";
+      body = "not found\n";
+    }
+    std::ostringstream head;
+    head << "HTTP/1.0 " << status << "\r\nContent-Type: " << type
+         << "\r\nContent-Length: " << body.size() << "\r\nConnection: close\r\n\r\n";
+    send_all(c, head.str() + body);
+  }
+
+  void run(void) {
+    for (;;) {
+      int c = accept(fd_, NULL, NULL);
+      if (stopping_) {
+        if (c >= 0) {
+          close(c);
+        }
+        return;
+      }
+      if (c >= 0) {
+        answer(c);
+        close(c);
+      }
+      else if (errno != EINTR && errno != ECONNABORTED) {
+        // the pending connection stays queued, so retrying at once would spin
+        std::this_thread::sleep_for(std::chrono::milliseconds(METRICS_ACCEPT_BACKOFF_MS));
+      }
+    }
+  }
+
+public:
+  /**
+   * Constructor, listens on 127.0.0.1 at the given port
+   * @param port the TCP port, or 0 to let the kernel pick one
+   */
+  explicit MetricsServer(int port) : fd_(-1), stopping_(false) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd_, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(fd_, 16) < 0) {
+      close(fd_);
+      fd_ = -1;
+      return;
+    }
+    thread_ = std::thread(&MetricsServer::run, this);
+  }
+
+  ~MetricsServer() {
+    if (fd_ < 0) {
+      return;
+    }
+    stopping_ = true;
+    // wakes the accept in run
+    shutdown(fd_, SHUT_RDWR);
+    thread_.join();
+    close(fd_);
+  }
+
+  /**
+   * @brief Whether the server is listening
+   */
+  bool ok(void) const {
+    return fd_ >= 0;
+  }
+
+  /**
+   * @brief the port the server is listening on
+   */
+  int port(void) const {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (fd_ < 0 || getsockname(fd_, (struct sockaddr*) &addr, &len) < 0) {
+      return -1;
+    }
+    return ntohs(addr.sin_port);
+  }
+
+  /**
+   * @brief Replaces what the server answers with
+   */
+  void publish(const Metrics& metrics) {
+    std::shared_ptr<Page> page(new Page());
+    page->prometheus = metrics.prometheus();
+    page->json = metrics.json();
+    std::atomic_store(&page_, std::shared_ptr<const Page>(page));
+  }
+};
+
+#endif
@@ -0,0 +1,333 @@
+/** @class MigrationTracker
+ * @brief Moves keys between servers asynchronously. The rings emit an event
+ * every time a key changes owner, background workers copy the data, and the
+ * change is committed once the copy is done. Until then, both the old and the
+ * new owner are reported for that key.
+ *
+ * @author ankitvgupta
+ * @author jonahkall
+ */
+#ifndef MIGRATION_HPP
+#define MIGRATION_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * A single ownership change. Sides are 0 for a standalone RingHash or the
+ * left ring of a CuckooRings, and 1 for the right ring.
+ */
+struct Migration {
+  long long key;
+  int from_side;
+  long long from;
+  int to_side;
+  long long to;
+  unsigned long long id;
+};
+
+/** @class MigrationQueue
+ * @brief A bounded lock-free multi-producer multi-consumer queue
+ * Source: Dmitry Vyukov, http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+ */
+template <typename T>
+class MigrationQueue {
+private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T data;
+  };
+
+  Cell* buffer_;
+  size_t mask_;
+
+  // keep the two cursors on separate cache lines
+  alignas(64) std::atomic<size_t> enqueue_pos_;
+  alignas(64) std::atomic<size_t> dequeue_pos_;
+
+public:
+  /**
+   * Constructor for the MigrationQueue
+   * @param capacity the maximum number of queued events, rounded up to a power of 2
+   */
+  MigrationQueue(size_t capacity) {
+    size_t sz = 2;
+    while (sz < capacity) {
+      sz <<= 1;
+    }
+    buffer_ = new Cell[sz];
+    mask_ = sz - 1;
+    for (size_t i = 0; i < sz; ++i) {
+      buffer_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    enqueue_pos_.store(0, std::memory_order_relaxed);
+    dequeue_pos_.store(0, std::memory_order_relaxed);
+  }
+
+  ~MigrationQueue() {
+    delete[] buffer_;
+  }
+
+  /**
+   * @brief Adds an element to the back of the queue
+   * @returns false if the queue is full
+   */
+  bool try_push(const T& data) {
+    Cell* cell;
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &buffer_[pos & mask_];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      intptr_t dif = (intptr_t) seq - (intptr_t) pos;
+      if (dif == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      }
+      else if (dif < 0) {
+        return false;
+      }
+      else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->data = data;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Removes the element at the front of the queue
+   * @returns false if the queue is empty
+   */
+  bool try_pop(T& data) {
+    Cell* cell;
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &buffer_[pos & mask_];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      intptr_t dif = (intptr_t) seq - (intptr_t) (pos + 1);
+      if (dif == 0) {
+        if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      }
+      else if (dif < 0) {
+        return false;
+      }
+      else {
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    data = cell->data;
+    cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+};
+
+class MigrationTracker {
+public:
+  typedef std::function<void(const Migration&)> Callback;
+
+private:
+  MigrationQueue<Migration> queue_;
+
+  /**
+   * Migrations that have been emitted but not yet committed, by key
+   */
+  std::unordered_map<long long, Migration> in_flight_;
+  std::mutex in_flight_lock_;
+
+  /**
+   * transfer_ copies the data for a key, commit_ is told once the move is done
+   */
+  Callback transfer_;
+  Callback commit_;
+
+  /**
+   * Idle workers sleep on wake_ until emit queues something or the tracker
+   * is destroyed
+   */
+  std::mutex wake_lock_;
+  std::condition_variable wake_;
+
+  std::vector<std::thread> workers_;
+  std::atomic<bool> stop_;
+  std::atomic<long long> pending_;
+  std::atomic<long long> completed_;
+  unsigned long long next_id_;
+
+  void work(void) {
+    Migration m;
+    for (;;) {
+      bool popped = false;
+      {
+        std::unique_lock<std::mutex> lock(wake_lock_);
+        wake_.wait(lock, [&] {
+          popped = queue_.try_pop(m);
+          return popped || stop_.load();
+        });
+      }
+      // the queue is drained before a stopped worker exits
+      if (!popped) {
+        return;
+      }
+      transfer_(m);
+      commit(m);
+    }
+  }
+
+public:
+  /**
+   * Constructor for the MigrationTracker
+   * @param capacity the number of events that can be queued before emit blocks
+   * @param num_workers the number of background threads copying data. With
+   *    no workers, events are handled by calling process_one.
+   * @param transfer called on a worker thread to copy the data for a key
+   * @param commit called on the same thread each time a migration commits,
+   *    or empty for none
+   */
+  MigrationTracker(size_t capacity, int num_workers, Callback transfer,
+      Callback commit = Callback()) :
+      queue_(capacity), transfer_(transfer), commit_(commit), stop_(false),
+      pending_(0), completed_(0), next_id_(0) {
+    for (int i = 0; i < num_workers; ++i) {
+      workers_.push_back(std::thread(&MigrationTracker::work, this));
+    }
+  }
+
+  /**
+   * Destructor, finishes every queued migration, on the workers if there
+   * are any and on the calling thread if not, before returning
+   */
+  ~MigrationTracker() {
+    {
+      std::lock_guard<std::mutex> guard(wake_lock_);
+      stop_.store(true);
+    }
+    wake_.notify_all();
+    for (auto& t : workers_) {
+      t.join();
+    }
+    while (process_one()) {
+    }
+  }
+
+  /**
+   * @brief Records that a key is changing owner and queues the copy.
+   *    Blocks while the queue is full.
+   */
+  void emit(long long key, int from_side, long long from, int to_side, long long to) {
+    Migration m;
+    m.key = key;
+    m.from_side = from_side;
+    m.from = from;
+    m.to_side = to_side;
+    m.to = to;
+    {
+      std::lock_guard<std::mutex> guard(in_flight_lock_);
+      m.id = next_id_++;
+      in_flight_[key] = m;
+    }
+    ++pending_;
+    while (!queue_.try_push(m)) {
+      if (workers_.empty()) {
+        process_one();
+      }
+      else {
+        std::this_thread::yield();
+      }
+    }
+    if (!workers_.empty()) {
+      // taking the lock orders the push before a worker's check of the queue
+      {
+        std::lock_guard<std::mutex> guard(wake_lock_);
+      }
+      wake_.notify_one();
+    }
+  }
+
+  /**
+   * @brief Marks a migration as done, so lookups stop reporting the old owner
+   */
+  void commit(const Migration& m) {
+    {
+      std::lock_guard<std::mutex> guard(in_flight_lock_);
+      auto it = in_flight_.find(m.key);
+      // a key that moved again since keeps its newer record
+      if (it != in_flight_.end() && it->second.id == m.id) {
+        in_flight_.erase(it);
+      }
+    }
+    if (commit_) {
+      commit_(m);
+    }
+    ++completed_;
+    --pending_;
+  }
+
+  /**
+   * @brief Handles a single queued migration on the calling thread
+   * @returns false if there was nothing queued
+   */
+  bool process_one(void) {
+    Migration m;
+    if (!queue_.try_pop(m)) {
+      return false;
+    }
+    transfer_(m);
+    commit(m);
+    return true;
+  }
+
+  /**
+   * @brief Finds the in-flight migration of a key
+   * @returns true and fills in m if the key is being migrated
+   */
+  bool in_flight(long long key, Migration* m) {
+    std::lock_guard<std::mutex> guard(in_flight_lock_);
+    auto it = in_flight_.find(key);
+    if (it == in_flight_.end()) {
+      return false;
+    }
+    *m = it->second;
+    return true;
+  }
+
+  /**
+   * @brief Blocks until every emitted migration has committed
+   */
+  void wait_idle(void) {
+    while (pending_.load() > 0) {
+      if (workers_.empty()) {
+        process_one();
+      }
+      else {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+      }
+    }
+  }
+
+  /**
+   * @brief the number of migrations emitted but not yet committed
+   */
+  long long num_pending(void) {
+    return pending_.load();
+  }
+
+  /**
+   * @brief the number of migrations committed so far
+   */
+  long long num_completed(void) {
+    return completed_.load();
+  }
+};
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ *  Tests that keys being migrated report both of their owners.
+ *  Add 100000 items to a RingHash with 20000 servers, then remove 1000 servers with a
+ *  MigrationTracker that has no workers, so nothing commits until it is asked to. Every
+ *  key that changed owner should report its new owner followed by its old one until its
+ *  migration is processed, and only its new owner after. Then do the same for the cuckoo
+ *  moves of CuckooRings, whose keys can move between the rings, and check that a tracker
+ *  with workers finishes every queued migration before its destructor returns.
+ * @author Ankit Gupta
+ * @author Jonah Kallenbach
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <set>
+#include <atomic>
+#include <time.h>
+#include <assert.h>
+#include <stdlib.h>
+
+#include "cuckoorings.hpp"
+
+using namespace std;
+
+#define KEYS 100000
+#define SERVERS 20000
+#define REMOVES 1000
+
+int main ()
+{
+  // initialize variables and seed the random number generator
+  srand (time(NULL));
+  long long transferred = 0, committed = 0;
+  auto transfer = [&](const Migration& m) {
+    (void) m;
+    ++transferred;
+  };
+  auto commit = [&](const Migration& m) {
+    (void) m;
+    ++committed;
+  };
+
+  // membership changes on a RingHash
+  RingHash r((1L << 32), SERVERS);
+  for (int i = 1; i <= KEYS; ++i) {
+    r.insert(i);
+  }
+  vector<long long> before(KEYS + 1);
+  for (int i = 1; i <= KEYS; ++i) {
+    before[i] = r.lookup(i);
+  }
+  {
+    MigrationTracker tracker(KEYS, 0, transfer, commit);
+    r.set_migration_tracker(&tracker);
+    set<long long> removed;
+    for (int i = 0; i < REMOVES; ++i) {
+      long long s = r.random_server();
+      removed.insert(s);
+      r.remove_server(s);
+    }
+    long long moved = 0;
+    for (int i = 1; i <= KEYS; ++i) {
+      vector<long long> owners = r.lookup_owners(i);
+      assert(owners[0] == r.lookup(i));
+      if (owners[0] != before[i]) {
+        ++moved;
+        // a key can move more than once, and its old owner is the last one
+        assert(owners.size() == 2 && removed.count(owners[1]));
+      }
+      else {
+        assert(owners.size() == 1);
+      }
+    }
+    long long pending = tracker.num_pending();
+    assert(pending >= moved && transferred == 0);
+    tracker.wait_idle();
+    for (int i = 1; i <= KEYS; ++i) {
+      assert(r.lookup_owners(i).size() == 1);
+    }
+    assert(transferred == pending && committed == pending);
+    r.set_migration_tracker(NULL);
+    cout << "RingHash" << endl;
+    cout << "    Keys with two owners after removing " << REMOVES << " servers: " << moved << endl;
+  }
+
+  // cuckoo moves, on the same ring and across the rings
+  transferred = committed = 0;
+  {
+    CuckooRings c((1L << 32), KEYS / SERVER_THRESHOLD);
+    MigrationTracker tracker(KEYS, 0, transfer, commit);
+    c.set_migration_tracker(&tracker);
+    for (int i = 1; i <= KEYS; ++i) {
+      c.insert(i);
+    }
+    long long dual = 0, across = 0;
+    for (int i = 1; i <= KEYS; ++i) {
+      vector<Placement> owners = c.lookup_owners(i);
+      Placement p = c.locate(i);
+      assert(owners[0].side == p.side && owners[0].server == p.server);
+      Migration m;
+      if (owners.size() == 2) {
+        ++dual;
+        across += owners[1].side != owners[0].side;
+        assert(tracker.in_flight(i, &m));
+        assert(m.from_side == owners[1].side && m.from == owners[1].server);
+        assert(m.to_side == p.side && m.to == p.server);
+      }
+    }
+    assert(across > 0);
+    long long pending = tracker.num_pending();
+    tracker.wait_idle();
+    for (int i = 1; i <= KEYS; ++i) {
+      assert(c.lookup_owners(i).size() == 1);
+    }
+    assert(transferred == committed && committed == pending);
+    c.set_migration_tracker(NULL);
+    cout << "CuckooRings" << endl;
+    cout << "    Keys with two owners after inserting " << KEYS << " keys: " << dual
+         << ", " << across << " of them across the rings" << endl;
+  }
+
+  // a tracker with workers drains its queue before it is destroyed
+  atomic<long long> done(0);
+  {
+    MigrationTracker tracker(64, 2, [&](const Migration& m) {
+      (void) m;
+      ++done;
+    });
+    for (int i = 1; i <= KEYS; ++i) {
+      tracker.emit(i, 0, 0, 0, 1);
+    }
+  }
+  assert(done.load() == KEYS);
+  cout << "Destroyed tracker finished all " << done.load() << " queued migrations" << endl;
+
+  return 0;
+}
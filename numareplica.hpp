@@ -0,0 +1,314 @@
+/** @class NumaReplicas
+ * @brief Per-NUMA-node copies of the read-mostly part of a ring, the sorted
+ * positions of its live servers, so that lookup threads never read the ring
+ * across the interconnect.
+ *
+ * Each replica is a sorted array split into blocks of REPLICA_BLOCK
+ * positions, each allocated on the replica's node. A membership change
+ * copies only the blocks it touches, and the new version shares every other
+ * block with the old one. A version is published with a single atomic
+ * store, so a lookup sees either every replica of the old version or every
+ * replica of the new one. Lookups pick the replica of the node the calling
+ * thread is running on.
+ *
+ * On a machine with a single node, or where the node of memory can't be
+ * chosen, there is just one replica in ordinary memory.
+ *
+ * @author ankitvgupta
+ * @author jonahkall
+ */
+#ifndef NUMAREPLICA_HPP
+#define NUMAREPLICA_HPP
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+
+// The number of positions in each block of a replica. Blocks split when
+// they reach twice this, so an update copies a few pages per node.
+#define REPLICA_BLOCK 512
+
+class NumaReplicas {
+private:
+  /**
+   * Some of the sorted positions of a replica, on one node. Blocks are never
+   * changed once built, so versions can share them.
+   */
+  struct Block {
+    long long* positions;
+    size_t size;
+    size_t bytes;
+
+    Block(const long long* src, size_t n, int node, bool bind) : size(n) {
+      bytes = std::max((size_t) 1, size) * sizeof(long long);
+      void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (p == MAP_FAILED) {
+        throw std::bad_alloc();
+      }
+#ifdef SYS_mbind
+      // the pages are placed on the node when they are first written below
+      if (bind) {
+        unsigned long mask = 1UL << node;
+        syscall(SYS_mbind, p, bytes, MPOL_BIND, &mask, sizeof(mask) * 8, 0);
+      }
+#else
+      (void) node;
+      (void) bind;
+#endif
+      positions = (long long*) p;
+      memcpy(positions, src, size * sizeof(long long));
+    }
+
+    ~Block() {
+      munmap(positions, bytes);
+    }
+  };
+
+  /**
+   * The positions of every live server, sorted, on one node, with the first
+   * position of each block so a lookup can find its block
+   */
+  struct Replica {
+    std::vector<std::shared_ptr<const Block> > blocks;
+    std::vector<long long> firsts;
+
+    /**
+     * @brief Adds blocks of up to REPLICA_BLOCK positions to the end
+     */
+    void append(const long long* src, size_t n, int node, bool bind) {
+      for (size_t i = 0; i < n; i += REPLICA_BLOCK) {
+        size_t m = std::min((size_t) REPLICA_BLOCK, n - i);
+        blocks.push_back(std::shared_ptr<const Block>(new Block(src + i, m, node, bind)));
+        firsts.push_back(src[i]);
+      }
+    }
+
+    /**
+     * @brief the block that holds a position if it is present, which is the
+     *    last one starting at or before it
+     */
+    size_t block_of(long long pos) const {
+      size_t b = std::upper_bound(firsts.begin(), firsts.end(), pos) - firsts.begin();
+      return b == 0 ? 0 : b - 1;
+    }
+  };
+
+  /**
+   * Everything a lookup needs, published as one unit
+   */
+  struct Version {
+    unsigned long long version;
+    long long kss;
+    std::function<long long(long long, long long)> hash;
+    std::vector<std::unique_ptr<Replica> > replicas;
+  };
+
+  std::shared_ptr<const Version> current_;
+  std::vector<int> nodes_;
+  int max_node_;
+
+  /**
+   * @brief Reads the online nodes, which sysfs lists as ranges like 0-1,3
+   */
+  void detect_nodes(void) {
+    std::ifstream in("/sys/devices/system/node/online");
+    std::string list;
+    if (in >> list) {
+      size_t i = 0;
+      while (i < list.size()) {
+        size_t end = list.find(',', i);
+        if (end == std::string::npos) {
+          end = list.size();
+        }
+        std::string range = list.substr(i, end - i);
+        size_t dash = range.find('-');
+        int lo = atoi(range.c_str());
+        int hi = dash == std::string::npos ? lo : atoi(range.c_str() + dash + 1);
+        // mbind is given a single word of node mask
+        for (int n = lo; n <= hi && n < 64; ++n) {
+          nodes_.push_back(n);
+        }
+        i = end + 1;
+      }
+    }
+    if (nodes_.empty()) {
+      nodes_.push_back(0);
+    }
+    max_node_ = *std::max_element(nodes_.begin(), nodes_.end());
+  }
+
+public:
+  NumaReplicas() {
+    detect_nodes();
+  }
+
+  /**
+   * @brief the number of nodes holding a replica
+   */
+  int num_nodes(void) const {
+    return nodes_.size();
+  }
+
+  /**
+   * @brief the node the calling thread is running on, or 0 if unknown
+   */
+  static int current_node(void) {
+    unsigned cpu = 0, node = 0;
+#ifdef SYS_getcpu
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) {
+      return 0;
+    }
+#endif
+    return node;
+  }
+
+  /**
+   * @brief Replaces every replica at once
+   * @param positions the positions of the live servers, in sorted order
+   * @param version a number identifying this layout, such as the ring's generation
+   * @param kss the key space size of the ring
+   * @param hash the hash function of the ring
+   */
+  void publish(const std::vector<long long>& positions, unsigned long long version,
+      long long kss, std::function<long long(long long, long long)> hash) {
+    std::shared_ptr<Version> v(new Version());
+    v->version = version;
+    v->kss = kss;
+    v->hash = hash;
+    v->replicas.resize(max_node_ + 1);
+    for (const auto& n : nodes_) {
+      v->replicas[n].reset(new Replica());
+      v->replicas[n]->append(positions.data(), positions.size(), n, nodes_.size() > 1);
+    }
+    std::atomic_store(&current_, std::shared_ptr<const Version>(v));
+  }
+
+  /**
+   * @brief Publishes a new version that differs from the current one by a
+   *    few positions, copying only the blocks they fall in
+   * @param changes the changed positions in sorted order, each with 1 if it
+   *    was added and -1 if it was removed
+   * @param from the version the changes were made to
+   * @param version a number identifying the new layout
+   * @returns false, publishing nothing, if the current version isn't from
+   */
+  bool update(const std::vector<std::pair<long long, int> >& changes,
+      unsigned long long from, unsigned long long version) {
+    std::shared_ptr<const Version> old = std::atomic_load(&current_);
+    if (!old || old->version != from) {
+      return false;
+    }
+    std::shared_ptr<Version> v(new Version());
+    v->version = version;
+    v->kss = old->kss;
+    v->hash = old->hash;
+    v->replicas.resize(max_node_ + 1);
+    std::vector<long long> merged;
+    for (const auto& n : nodes_) {
+      const Replica* r = old->replicas[n].get();
+      Replica* fresh = new Replica();
+      v->replicas[n].reset(fresh);
+      size_t b = 0;
+      std::vector<std::pair<long long, int> >::const_iterator c = changes.begin();
+      while (c != changes.end()) {
+        // share the blocks before the next change, then rebuild its block
+        // with every change that falls in it
+        size_t target = r->blocks.empty() ? 0 : r->block_of(c->first);
+        for (; b < target; ++b) {
+          fresh->blocks.push_back(r->blocks[b]);
+          fresh->firsts.push_back(r->firsts[b]);
+        }
+        merged.clear();
+        if (b < r->blocks.size()) {
+          merged.assign(r->blocks[b]->positions, r->blocks[b]->positions + r->blocks[b]->size);
+          ++b;
+        }
+        for (; c != changes.end() && (r->blocks.empty() || r->block_of(c->first) == target); ++c) {
+          std::vector<long long>::iterator at = std::lower_bound(merged.begin(), merged.end(), c->first);
+          if (c->second > 0 && (at == merged.end() || *at != c->first)) {
+            merged.insert(at, c->first);
+          }
+          else if (c->second < 0 && at != merged.end() && *at == c->first) {
+            merged.erase(at);
+          }
+        }
+        if (merged.size() < 2 * REPLICA_BLOCK) {
+          if (!merged.empty()) {
+            fresh->blocks.push_back(std::shared_ptr<const Block>(
+                new Block(merged.data(), merged.size(), n, nodes_.size() > 1)));
+            fresh->firsts.push_back(merged[0]);
+          }
+        }
+        else {
+          fresh->append(merged.data(), merged.size(), n, nodes_.size() > 1);
+        }
+      }
+      for (; b < r->blocks.size(); ++b) {
+        fresh->blocks.push_back(r->blocks[b]);
+        fresh->firsts.push_back(r->firsts[b]);
+      }
+    }
+    std::atomic_store(&current_, std::shared_ptr<const Version>(v));
+    return true;
+  }
+
+  /**
+   * @brief the version of the replicas lookups are reading, or 0 before the first publish
+   */
+  unsigned long long version(void) const {
+    std::shared_ptr<const Version> v = std::atomic_load(&current_);
+    return v ? v->version : 0;
+  }
+
+  /**
+   * @brief Finds the server that owns a key in the replica on a given node.
+   *    Safe to call from any number of threads while the ring publishes.
+   * @returns the position of the server, or -1 if nothing has been published
+   *    or the ring has no live servers
+   */
+  long long lookup_on(int node, long long key) const {
+    std::shared_ptr<const Version> v = std::atomic_load(&current_);
+    if (!v) {
+      return -1;
+    }
+    const Replica* r = node >= 0 && node <= max_node_ ? v->replicas[node].get() : NULL;
+    if (!r) {
+      r = v->replicas[nodes_[0]].get();
+    }
+    if (r->blocks.empty()) {
+      return -1;
+    }
+    // the first server at or after the key's position, wrapping around
+    long long pos = v->hash(key, v->kss);
+    size_t b = r->block_of(pos);
+    const Block* block = r->blocks[b].get();
+    const long long* it = std::lower_bound(block->positions, block->positions + block->size, pos);
+    if (it != block->positions + block->size) {
+      return *it;
+    }
+    return b + 1 < r->blocks.size() ? r->firsts[b + 1] : r->firsts[0];
+  }
+
+  /**
+   * @brief Finds the server that owns a key in the replica on the calling
+   *    thread's node
+   */
+  long long lookup_local(long long key) const {
+    return lookup_on(current_node(), key);
+  }
+};
+
+#endif
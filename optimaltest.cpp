@@ -0,0 +1,69 @@
+/*
+ *  Tests how far the greedy cuckoo placement is from optimal.
+ *  Add 100000 to 2000000 keys to 1000000 servers with CuckooRings::insert, then
+ *  move them to the optimal placement with CuckooRings::rebalance_optimal, and
+ *  track the time, the cost and the max load of both, and how many keys moved.
+ * @author Ankit Gupta
+ * @author Jonah Kallenbach
+ */
+
+#include <iostream>
+#include <string>
+#include <time.h>
+#include <assert.h>
+#include <stdlib.h>
+
+#include "cuckoorings.hpp"
+#include "perfcounters.hpp"
+
+using namespace std;
+
+int main ()
+{
+  // initialize variables and seed the random number generator
+  clock_t t1, t2;
+  srand (time(NULL));
+  PerfCounters perf;
+  int i, j;
+
+  // repeat the experiment several times
+  for (int repeat = 1; repeat < 4; ++repeat) {
+    for (j = 100000; j <= 2000000; j += 100000) {
+
+      // initialize the data structures
+      CuckooRings c((1L << 32), 500000);
+
+      // greedy placement
+      t1 = clock();
+      perf.start();
+      for (i = 1; i <= j; ++i) {
+        c.insert(i);
+      }
+      perf.stop();
+      t2 = clock();
+
+      // print statistics
+      cout << ((float)(t2-t1))/CLOCKS_PER_SEC << ",";
+      cout << ((float) c.cost_of_structure()) / c.getNumServers() << ",";
+      cout << c.get_max_load() << endl;
+      perf.report("CuckooRings insert", j);
+
+      // optimal placement
+      t1 = clock();
+      perf.start();
+      long long moved = c.rebalance_optimal();
+      perf.stop();
+      t2 = clock();
+      assert(c.getNumKeys() == j);
+
+      // print statistics
+      cout << ((float)(t2-t1))/CLOCKS_PER_SEC << ",";
+      cout << ((float) c.cost_of_structure()) / c.getNumServers() << ",";
+      cout << c.get_max_load() << ",";
+      cout << moved << endl;
+      perf.report("CuckooRings rebalance_optimal", j);
+    }
+  }
+
+  return 0;
+}
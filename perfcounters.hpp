@@ -0,0 +1,182 @@
+/** @class PerfCounters
+ * @brief Hardware counters around a measured phase of a benchmark: cycles,
+ * instructions, L1 data cache misses, last level cache misses and branch
+ * misses, read through perf_event_open and reported per operation.
+ *
+ * Counting is off unless the PERF_COUNTERS environment variable is set, and
+ * reports go to cerr so the CSV the drivers print on cout is unchanged. A
+ * counter the kernel or the machine can't provide (no PMU in a VM, a
+ * restrictive perf_event_paranoid) is reported as n/a and the rest still work.
+ *
+ * @author ankitvgupta
+ * @author jonahkall
+ */
+#ifndef PERFCOUNTERS_HPP
+#define PERFCOUNTERS_HPP
+
+#include <iostream>
+#include <string>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#endif
+
+class PerfCounters {
+public:
+  enum Counter { CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES, BRANCH_MISSES, NUM_COUNTERS };
+
+private:
+  int fds_[NUM_COUNTERS];
+  uint64_t values_[NUM_COUNTERS];
+  bool enabled_;
+
+  static const char* name(int c) {
+    static const char* names[NUM_COUNTERS] =
+        { "cycles", "instructions", "L1d misses", "LLC misses", "branch misses" };
+    return names[c];
+  }
+
+#ifdef __linux__
+  static int open_counter(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // scale for the time the counter was multiplexed out
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+#endif
+
+public:
+  /**
+   * Constructor, opens whichever counters are available if PERF_COUNTERS is set
+   */
+  PerfCounters() : enabled_(getenv("PERF_COUNTERS") != NULL) {
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+      fds_[c] = -1;
+      values_[c] = 0;
+    }
+#ifdef __linux__
+    if (!enabled_) {
+      return;
+    }
+    const uint64_t l1d_miss = PERF_COUNT_HW_CACHE_L1D |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    fds_[CYCLES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    fds_[INSTRUCTIONS] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    fds_[L1D_MISSES] = open_counter(PERF_TYPE_HW_CACHE, l1d_miss);
+    fds_[LLC_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    fds_[BRANCH_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    if (!available()) {
+      std::cerr << "perf counters unavailable, reporting without them" << std::endl;
+    }
+#else
+    enabled_ = false;
+#endif
+  }
+
+  ~PerfCounters() {
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+      if (fds_[c] >= 0) {
+        close(fds_[c]);
+      }
+    }
+  }
+
+  /**
+   * @brief Whether counting was asked for with PERF_COUNTERS
+   */
+  bool enabled(void) const {
+    return enabled_;
+  }
+
+  /**
+   * @brief Whether at least one counter could be opened
+   */
+  bool available(void) const {
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+      if (fds_[c] >= 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * @brief Zeroes the counters and starts counting
+   */
+  void start(void) {
+#ifdef __linux__
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+      if (fds_[c] >= 0) {
+        ioctl(fds_[c], PERF_EVENT_IOC_RESET, 0);
+        ioctl(fds_[c], PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+#endif
+  }
+
+  /**
+   * @brief Stops counting and reads the counters
+   */
+  void stop(void) {
+#ifdef __linux__
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+      values_[c] = 0;
+      if (fds_[c] < 0) {
+        continue;
+      }
+      ioctl(fds_[c], PERF_EVENT_IOC_DISABLE, 0);
+      uint64_t buf[3];
+      if (read(fds_[c], buf, sizeof(buf)) == sizeof(buf) && buf[2] > 0) {
+        values_[c] = (uint64_t) ((double) buf[0] * buf[1] / buf[2]);
+      }
+    }
+#endif
+  }
+
+  /**
+   * @brief the value of a counter over the last phase
+   */
+  uint64_t value(Counter c) const {
+    return values_[c];
+  }
+
+  /**
+   * @brief Prints the counters of the last phase per operation, on one line
+   * @param label the name of the phase
+   * @param ops the number of operations in it
+   */
+  void report(const std::string& label, long long ops, std::ostream& out = std::cerr) const {
+    if (!enabled_) {
+      return;
+    }
+    out << label << " (" << ops << " ops):";
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+      out << " " << name(c) << "/op=";
+      if (fds_[c] < 0 || ops <= 0) {
+        out << "n/a";
+      }
+      else {
+        out << (double) values_[c] / ops;
+      }
+    }
+    if (fds_[CYCLES] >= 0 && fds_[INSTRUCTIONS] >= 0 && values_[CYCLES] > 0) {
+      out << " IPC=" << (double) values_[INSTRUCTIONS] / values_[CYCLES];
+    }
+    out << std::endl;
+  }
+};
+
+#endif
@@ -2,6 +2,9 @@
  *  Tests speed benefits of a random set of insertions, along with server removals
  *  Increment j in steps to 50,000 up to 1,000,000. For each j, make Ring and CuckooRing of that many servers.
  *  For j steps, add items to the servers, and with small probability remove a server.
+ *  If METRICS_FILE is set, the metrics of each structure are written there after its
+ *  run, as JSON if the name ends in .json and in Prometheus text format otherwise.
+ *  Usage: randomactionstest [seed]
  * @author Ankit Gupta
  * @author Jonah Kallenbach
  */
@@ -16,14 +19,20 @@
 #include <stdlib.h>
 
 #include "cuckoorings.hpp"
+#include "perfcounters.hpp"
 
 using namespace std;
 
-int main ()        
+int main (int argc, char** argv)
 {
-  // initialize variables and seed the random number generator
+  // initialize variables and seed the random number generator. The rings
+  // seed themselves from it, so passing the seed of a run repeats it exactly.
   clock_t t1, t2, t3;
-  srand (time(NULL));
+  unsigned long long seed = argc > 1 ? strtoull(argv[1], NULL, 10) : time(NULL);
+  srand (seed);
+  cerr << "seed: " << seed << endl;
+  const char* metrics_file = getenv("METRICS_FILE");
+  PerfCounters perf;
   int i, j, val;
 
   // repeat the experiment several times
@@ -36,6 +45,7 @@ int main ()
 
       // begin timing the RingHash
       t1 = clock();
+      perf.start();
 
       // insert an increaasing number of keys into the RingHash
       // with small probability, either remove or add a server randomly
@@ -53,15 +63,23 @@ int main ()
         r.insert(val);
       }
 
+      perf.stop();
       t2 = clock();
 
       // print statistics
       cout << ((float)(t2-t1))/CLOCKS_PER_SEC << ",";
       cout << ((float) r.cost_of_structure()) / r.getNumServers() << ",";
       cout << r.get_max_load() << endl;
+      perf.report("RingHash random actions", j + 1);
+      if (metrics_file) {
+        Metrics m;
+        r.metrics(m, {{"test", "randomactions"}});
+        m.write(metrics_file);
+      }
 
       // reset the clock
       t1 = clock();
+      perf.start();
 
       // insert an increaasing number of keys into the RingHash
       // with small probability, either remove or add a server randomly
@@ -77,12 +95,19 @@ int main ()
         }
         c.insert(val);
       }
+      perf.stop();
       t2 = clock();
 
       // print statistics
       cout << ((float)(t2-t1))/CLOCKS_PER_SEC << ",";
       cout << ((float) c.cost_of_structure()) / c.getNumServers() << ",";
       cout << c.get_max_load() << endl;
+      perf.report("CuckooRings random actions", j + 1);
+      if (metrics_file) {
+        Metrics m;
+        c.metrics(m, {{"test", "randomactions"}});
+        m.write(metrics_file);
+      }
     } 
   }
 
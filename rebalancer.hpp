@@ -0,0 +1,243 @@
+/** @class Rebalancer
+ * @brief Finds the best placement of a set of keys that each have two
+ * candidate servers, as in CuckooRings. Each key is an edge between its two
+ * servers, pointing away from the one that holds it, and placing the keys is
+ * choosing a direction for every edge.
+ *
+ * For any convex cost of a server's load, such as the squared load that
+ * cost_of_structure adds up, a placement is optimal exactly when no chain of
+ * keys leads from a server with load L to one with load L-2 or less: moving
+ * the keys along such a chain is the only way to change the loads without
+ * changing any other server. The same placement also has the smallest
+ * possible max load.
+ *
+ * The solver removes those chains one level at a time, from the highest load
+ * down. At each level it runs phases of Dinic's blocking flow: a breadth-first
+ * search from every server at the level or above, then a walk along shortest
+ * chains to servers with room until none is left. Once a level is done no
+ * later level can give it a chain again, so each level is only solved once.
+ * It starts from the placement it is given, so solving a placement that is
+ * already close to optimal is cheap.
+ *
+ * @author ankitvgupta
+ * @author jonahkall
+ */
+#ifndef REBALANCER_HPP
+#define REBALANCER_HPP
+
+#include <algorithm>
+#include <vector>
+
+class Rebalancer {
+private:
+  int num_servers_;
+
+  /**
+   * The two servers of each key, and which of the two holds it
+   */
+  std::vector<int> ends_[2];
+  std::vector<char> side_;
+
+  std::vector<int> load_;
+
+  /**
+   * The keys touching each server, held or not, as offsets into one array
+   */
+  std::vector<size_t> first_;
+  std::vector<int> incident_;
+
+  long long moves_;
+
+  int holder(int k) const {
+    return ends_[(int) side_[k]][k];
+  }
+
+  int other(int k) const {
+    return ends_[1 - side_[k]][k];
+  }
+
+  void build_incidence(void) {
+    first_.assign(num_servers_ + 1, 0);
+    for (size_t k = 0; k < side_.size(); ++k) {
+      ++first_[ends_[0][k] + 1];
+      ++first_[ends_[1][k] + 1];
+    }
+    for (int u = 0; u < num_servers_; ++u) {
+      first_[u + 1] += first_[u];
+    }
+    incident_.resize(2 * side_.size());
+    std::vector<size_t> next(first_.begin(), first_.end() - 1);
+    for (size_t k = 0; k < side_.size(); ++k) {
+      incident_[next[ends_[0][k]]++] = k;
+      incident_[next[ends_[1][k]]++] = k;
+    }
+  }
+
+  /**
+   * @brief Labels every server with its distance from the servers at load
+   *    level or above, following held keys to their other server
+   * @returns whether a server with load level-2 or less was reached
+   */
+  bool layer(int level, std::vector<int>& dist, std::vector<int>& queue) {
+    std::fill(dist.begin(), dist.end(), -1);
+    queue.clear();
+    for (int u = 0; u < num_servers_; ++u) {
+      if (load_[u] >= level) {
+        dist[u] = 0;
+        queue.push_back(u);
+      }
+    }
+    int found = -1;
+    for (size_t head = 0; head < queue.size(); ++head) {
+      int u = queue[head];
+      // nothing past the first layer with room is needed for shortest chains
+      if (found >= 0 && dist[u] >= found) {
+        break;
+      }
+      for (size_t i = first_[u]; i < first_[u + 1]; ++i) {
+        int k = incident_[i];
+        if (holder(k) != u) {
+          continue;
+        }
+        int v = other(k);
+        if (dist[v] < 0) {
+          dist[v] = dist[u] + 1;
+          queue.push_back(v);
+          if (found < 0 && load_[v] <= level - 2) {
+            found = dist[v];
+          }
+        }
+      }
+    }
+    return found >= 0;
+  }
+
+  /**
+   * @brief Moves keys along shortest chains from one server until it is
+   *    below level or no chain is left in this phase
+   */
+  void drain(int source, int level, std::vector<int>& dist, std::vector<size_t>& arc,
+      std::vector<int>& path) {
+    while (load_[source] >= level) {
+      // path holds the keys of the chain walked so far
+      path.clear();
+      int u = source;
+      while (!(dist[u] > 0 && load_[u] <= level - 2)) {
+        int k = -1;
+        for (; arc[u] < first_[u + 1]; ++arc[u]) {
+          int c = incident_[arc[u]];
+          if (holder(c) == u && dist[other(c)] == dist[u] + 1) {
+            k = c;
+            break;
+          }
+        }
+        if (k >= 0) {
+          path.push_back(k);
+          u = other(k);
+          continue;
+        }
+        // a dead end: drop it from this phase and back up a step
+        dist[u] = -1;
+        if (path.empty()) {
+          return;
+        }
+        u = holder(path.back());
+        path.pop_back();
+        ++arc[u];
+      }
+      for (const auto& k : path) {
+        side_[k] = 1 - side_[k];
+        ++moves_;
+      }
+      --load_[source];
+      ++load_[u];
+    }
+  }
+
+public:
+  /**
+   * Constructor for Rebalancer
+   * @param num_servers the number of servers, numbered from 0
+   */
+  explicit Rebalancer(int num_servers = 0) :
+      num_servers_(num_servers), load_(num_servers, 0), moves_(0) {}
+
+  /**
+   * @brief Drops every key and starts over with a new number of servers
+   */
+  void reset(int num_servers) {
+    num_servers_ = num_servers;
+    ends_[0].clear();
+    ends_[1].clear();
+    side_.clear();
+    load_.assign(num_servers, 0);
+    moves_ = 0;
+  }
+
+  /**
+   * @brief Adds a key
+   * @param a the first server of the key
+   * @param b the second server of the key
+   * @param side 0 if the key is on a, 1 if it is on b
+   */
+  void add_key(int a, int b, int side) {
+    ends_[0].push_back(a);
+    ends_[1].push_back(b);
+    side_.push_back(side);
+    ++load_[side ? b : a];
+  }
+
+  /**
+   * @brief Moves keys until the placement is optimal
+   * @returns the number of times a key changed server. A key on a chain
+   *    that is later undone counts each time.
+   */
+  long long solve(void) {
+    if (side_.empty()) {
+      return 0;
+    }
+    build_incidence();
+    std::vector<int> dist(num_servers_), queue, path;
+    std::vector<size_t> arc(num_servers_);
+    int top = *std::max_element(load_.begin(), load_.end());
+    for (int level = top; level >= 2; --level) {
+      while (layer(level, dist, queue)) {
+        std::copy(first_.begin(), first_.end() - 1, arc.begin());
+        for (int u = 0; u < num_servers_; ++u) {
+          if (dist[u] == 0 && load_[u] >= level) {
+            drain(u, level, dist, arc, path);
+          }
+        }
+      }
+    }
+    return moves_;
+  }
+
+  /**
+   * @brief which server of a key holds it, 0 for the first and 1 for the second
+   */
+  int side(size_t k) const {
+    return side_[k];
+  }
+
+  int load(int server) const {
+    return load_[server];
+  }
+
+  int max_load(void) const {
+    return load_.empty() ? 0 : *std::max_element(load_.begin(), load_.end());
+  }
+
+  /**
+   * @brief the sum of the squared loads, as cost_of_structure counts it
+   */
+  long long cost(void) const {
+    long long cost = 0;
+    for (const auto& l : load_) {
+      cost += (long long) l * l;
+    }
+    return cost;
+  }
+};
+
+#endif
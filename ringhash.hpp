@@ -4,6 +4,9 @@
  * @author ankitvgupta
  * @author jonahkall
  */
+#ifndef RINGHASH_HPP
+#define RINGHASH_HPP
+
 #include <iostream>
 #include <string>
 #include <set>
@@ -12,41 +15,51 @@
 #include <math.h>
 #include <vector>
 #include <climits>
+#include <algorithm>
+#include <random>
+#include <unordered_map>
+#include <stdint.h>
+
+#include "bucket.hpp"
+#include "hashes.hpp"
+#include "lookupcache.hpp"
+#include "numareplica.hpp"
+#include "migration.hpp"
+#include "metrics.hpp"
+#include "memoryusage.hpp"
 
 // 2, 5, 10
 #define SERVER_THRESHOLD 10
 
-using namespace std;
+// The number of keys a bucket holds inline: as many as fit in the cache
+// lines needed for SERVER_THRESHOLD + 1 keys, their fingerprints and the
+// 16 byte header
+#define BUCKET_LINES ((16 + 5 * (SERVER_THRESHOLD + 1) + 7 + 63) / 64)
+#define BUCKET_INLINE ((BUCKET_LINES * 64 - 16 - 7) / 5)
 
-/**
- * @brief A standard hash function used in the absense of one passed in
-   * @param a the number that being hashed
-   * @param kss_ the key space size
-   * @returns a hash between 0 and kss_
-   * Source: Thomas Wang, http://burtleburtle.net/bob/hash/integer.html
- */
-long long hashstd(long long a, long long kss_) {
-  a = (a+0x7ed55d16) + (a<<12);
-  a = (a^0xc761c23c) ^ (a>>19);
-  a = (a+0x165667b1) + (a<<5);
-  a = (a+0xd3a2646c) ^ (a<<9);
-  a = (a+0xfd7046c5) + (a<<3);
-  a = (a^0xb55a4f09) ^ (a>>16);
-  return abs(((a % kss_) + kss_) % kss_);
-}
+// The number of lookups lookup_batch keeps in flight at once
+#define LOOKUP_GROUP 16
+
+using namespace std;
 
 class RingHash {
+public:
+  /**
+   * The keys held by a single server, stored inline up to BUCKET_INLINE keys
+   */
+  typedef InlineBucket<BUCKET_INLINE> Bucket;
+
 private:
 
   // Wrappers around standard C++ types
   typedef long long server_id;
-  typedef std::map<unsigned long long, std::vector<int> > MapType;
+  typedef std::map<unsigned long long, Bucket> MapType;
   typedef MapType::iterator MapIterator;
-  typedef std::vector<int>::iterator VectorIterator;
+  typedef Bucket::iterator VectorIterator;
 
   /**
    * Create a std::map that forms consistent hashing rings. The keys of this maps
-   * are the locations of the servers. The values are vectors containing the elements
+   * are the locations of the servers. The values are buckets containing the elements
    * hashed there.
    *
    * This is implemented as a red-black tree, with amortized O(log n)
@@ -65,23 +78,513 @@ private:
   int num_servers_;
   int num_keys_;
   std::function<long long(long long, long long)> hash;
+
+  /**
+   * When set, every key that changes owner is reported here so the data can
+   * be moved in the background. side_ tags the events with the ring they came from.
+   */
+  MigrationTracker* migrations_;
+  int side_;
+
+  /**
+   * Servers removed with remove_server_lazy that still hold keys. Lookups
+   * skip them, and they are erased from cache_indices_ once empty.
+   */
+  std::set<server_id> dead_;
+
+  /**
+   * Servers that keys moving off of dead servers pushed over
+   * SERVER_THRESHOLD. They are only collected when collect_overflow_ is
+   * set, by CuckooRings, which relieves them.
+   */
+  std::vector<server_id> overflow_;
+  bool collect_overflow_;
+
+  /**
+   * The live servers in no particular order, and where each one sits in
+   * that list, so a server can be picked uniformly and dropped in O(1)
+   */
+  std::vector<server_id> live_;
+  std::unordered_map<server_id, size_t> live_slot_;
+
+  /**
+   * How many servers, dead ones included, hold each number of keys, and the
+   * sum of their squared loads. Every change to the size of a bucket is
+   * counted here, so metrics never have to walk the ring.
+   */
+  std::vector<long long> load_counts_;
+  long long load_squares_;
+
+  /**
+   * Servers that joined or left the live set since the ring was built
+   */
+  long long servers_added_;
+  long long servers_removed_;
+
+  /**
+   * An optional direct-mapped index over the ring. Slot b holds the first
+   * server whose position maps to slot b or later, so a lookup reads one
+   * slot and then walks past at most a few servers. It is empty when off.
+   */
+  struct IndexSlot {
+    unsigned long long pos;
+    MapIterator it;
+  };
+  std::vector<IndexSlot> index_;
+
+  /**
+   * Maps a position to its slot, (pos * index_scale_) >> 64
+   */
+  unsigned long long index_scale_;
+
+  /**
+   * Bumped on every change to the set of live servers, which is exactly
+   * when lookup can start giving a different answer for a key
+   */
+  unsigned long long generation_;
+
+  /**
+   * An optional cache of lookup results, tagged with generation_
+   */
+  LookupCache<server_id> cache_;
+
+  /**
+   * When set, per-node copies of the live server positions, updated after
+   * every membership change
+   */
+  NumaReplicas* replicas_;
+
+  /**
+   * The live servers added (1) and removed (-1) since the replicas were
+   * last published, so only the blocks holding them are copied
+   */
+  std::map<server_id, int> replica_changes_;
+
+  /**
+   * Picks random servers and the positions of new ones. Unless seed() is
+   * called it is seeded from rand(), so srand still decides what a run does.
+   */
+  std::mt19937_64 rng_;
+
+  /**
+   * @brief Records that a bucket went from one size to another
+   */
+  void count_load(size_t from, size_t to) {
+    if (from == to) {
+      return;
+    }
+    if (to >= load_counts_.size()) {
+      load_counts_.resize(to + 1, 0);
+    }
+    --load_counts_[from];
+    ++load_counts_[to];
+    load_squares_ += (long long) to * to - (long long) from * from;
+  }
+
+  /**
+   * @brief Records that a server with the given load joined or left the ring
+   */
+  void count_server(size_t load, int delta) {
+    if (load >= load_counts_.size()) {
+      load_counts_.resize(load + 1, 0);
+    }
+    load_counts_[load] += delta;
+    load_squares_ += delta * (long long) load * load;
+  }
+
+  /**
+   * @brief Adds a server to the end of the live list
+   */
+  void track_live(server_id s) {
+    live_slot_[s] = live_.size();
+    live_.push_back(s);
+    if (replicas_ && ++replica_changes_[s] == 0) {
+      replica_changes_.erase(s);
+    }
+  }
+
+  /**
+   * @brief Drops a server from the live list by moving the last one into its place
+   */
+  void untrack_live(server_id s) {
+    std::unordered_map<server_id, size_t>::iterator it = live_slot_.find(s);
+    if (it == live_slot_.end()) {
+      return;
+    }
+    live_[it->second] = live_.back();
+    live_slot_[live_.back()] = it->second;
+    live_.pop_back();
+    live_slot_.erase(it);
+    if (replicas_ && --replica_changes_[s] == 0) {
+      replica_changes_.erase(s);
+    }
+    ++servers_removed_;
+  }
+
+  size_t slot_of(unsigned long long pos) {
+    return (size_t) (((unsigned __int128) pos * index_scale_) >> 64);
+  }
+
+  /**
+   * @brief Rebuilds the index with the given number of slots in one pass
+   */
+  void build_index(size_t slots) {
+    index_scale_ = (unsigned long long) (((unsigned __int128) slots << 64) / kss_);
+    index_.resize(slots);
+    MapIterator m = cache_indices_.begin();
+    for (size_t b = 0; b < slots; ++b) {
+      while (m != cache_indices_.end() && slot_of(m->first) < b) {
+        ++m;
+      }
+      index_[b].it = m;
+      index_[b].pos = m == cache_indices_.end() ? ULLONG_MAX : m->first;
+    }
+  }
+
+  /**
+   * @brief Copies another ring. The index holds iterators into the map, so
+   *    rather than being copied it is rebuilt over this ring's own map.
+   */
+  void copy_from(const RingHash& other) {
+    cache_indices_ = other.cache_indices_;
+    kss_ = other.kss_;
+    num_servers_ = other.num_servers_;
+    num_keys_ = other.num_keys_;
+    hash = other.hash;
+    migrations_ = NULL;
+    side_ = other.side_;
+    dead_ = other.dead_;
+    overflow_ = other.overflow_;
+    collect_overflow_ = other.collect_overflow_;
+    live_ = other.live_;
+    live_slot_ = other.live_slot_;
+    load_counts_ = other.load_counts_;
+    load_squares_ = other.load_squares_;
+    servers_added_ = other.servers_added_;
+    servers_removed_ = other.servers_removed_;
+    index_.clear();
+    index_scale_ = 0;
+    if (!other.index_.empty()) {
+      build_index(other.index_.size());
+    }
+    generation_ = other.generation_;
+    cache_ = other.cache_;
+    replicas_ = NULL;
+    replica_changes_.clear();
+    rng_ = other.rng_;
+  }
+
+  /**
+   * @brief Finds the first server at or after a position, wrapping around
+   *    the ring, through the index when it is on
+   */
+  MapIterator successor(unsigned long long pos) {
+    MapIterator m;
+    if (!index_.empty()) {
+      const IndexSlot& slot = index_[slot_of(pos)];
+      m = slot.it;
+      if (slot.pos < pos) {
+        while (m != cache_indices_.end() && m->first < pos) {
+          ++m;
+        }
+      }
+    }
+    else {
+      m = cache_indices_.lower_bound(pos);
+    }
+    if (m == cache_indices_.end()){
+      m = cache_indices_.begin();
+    }
+    return m;
+  }
+
+  /**
+   * @brief Puts an empty server on the ring, keeping the index up to date
+   * @returns whether there was no server at that position already
+   */
+  bool add_position(unsigned long long pos) {
+    std::pair<MapIterator, bool> ins = cache_indices_.insert(std::make_pair(pos, Bucket()));
+    if (ins.second) {
+      ++generation_;
+      track_live(pos);
+      count_server(0, 1);
+      ++servers_added_;
+    }
+    if (!ins.second || index_.empty()) {
+      return ins.second;
+    }
+    if (cache_indices_.size() > 2 * index_.size()) {
+      build_index(2 * index_.size());
+      return true;
+    }
+    // every slot up to this one that pointed past pos now points at it
+    for (size_t b = slot_of(pos) + 1; b-- > 0 && index_[b].pos > pos; ) {
+      index_[b].pos = pos;
+      index_[b].it = ins.first;
+    }
+    return true;
+  }
+
+  /**
+   * @brief Takes a server off of the ring, keeping the index up to date
+   */
+  void erase_position(MapIterator m) {
+    ++generation_;
+    untrack_live(m->first);
+    count_server(m->second.size(), -1);
+    if (!index_.empty()) {
+      MapIterator next = m;
+      ++next;
+      unsigned long long next_pos = next == cache_indices_.end() ? ULLONG_MAX : next->first;
+      for (size_t b = slot_of(m->first) + 1; b-- > 0 && index_[b].it == m; ) {
+        index_[b].pos = next_pos;
+        index_[b].it = next;
+      }
+    }
+    cache_indices_.erase(m);
+  }
+
+  /**
+   * @brief Finds the first live server at or after a position on the ring
+   * @param m the server at or after the position
+   * @returns iterator to that server, or m itself if every server is dead
+   */
+  MapIterator skip_dead(MapIterator m) {
+    MapIterator start = m;
+    while (dead_.find(m->first) != dead_.end()) {
+      ++m;
+      if (m == cache_indices_.end()) {
+        m = cache_indices_.begin();
+      }
+      if (m == start) {
+        break;
+      }
+    }
+    return m;
+  }
+
+  /**
+   * @brief Finds the server that owns a key
+   * @returns iterator to the live server that owns the key
+   */
+  MapIterator find_server(long long key) {
+    MapIterator m = successor(hash(key, kss_));
+    if (!dead_.empty() && dead_.find(m->first) != dead_.end()) {
+      return lookup_past_dead(key, m);
+    }
+    return m;
+  }
+
+  /**
+   * @brief Puts a key on a given server, unless it is already there
+   * @returns -1 if insertion is fine, the server_id if it is now over SERVER_THRESHOLD
+   */
+  server_id insert_at(MapIterator m, int key) {
+    Bucket& keys = m->second;
+    if (keys.contains(key)) {
+      return -1;
+    }
+    ++num_keys_;
+    keys.push_back(key);
+    count_load(keys.size() - 1, keys.size());
+    if (keys.size() > SERVER_THRESHOLD) {
+      return m->first;
+    }
+    return -1;
+  }
+
+  /**
+   * @brief Takes a key off of a given server
+   * @returns whether the key was there
+   */
+  bool remove_at(MapIterator m, int key) {
+    if (m->second.erase_key(key)) {
+      --num_keys_;
+      count_load(m->second.size() + 1, m->second.size());
+      return true;
+    }
+    return false;
+  }
+
+  /**
+   * @brief Collects a server that a key moved off of a dead server may
+   *    have pushed over SERVER_THRESHOLD
+   */
+  void note_overflow(MapIterator m) {
+    if (collect_overflow_ && m->second.size() > SERVER_THRESHOLD &&
+        (overflow_.empty() || overflow_.back() != (server_id) m->first)) {
+      overflow_.push_back(m->first);
+    }
+  }
+
+  /**
+   * @brief Calls f(server_id, load) for every live server, where the load
+   *    also counts the keys on the dead servers just before it, which are
+   *    the ones a sweep would give it
+   */
+  template <typename F>
+  void for_each_live_load(F f) {
+    if (dead_.empty()) {
+      for (const auto& x : cache_indices_) {
+        f(x.first, (long long) x.second.size());
+      }
+      return;
+    }
+    if (live_.empty()) {
+      return;
+    }
+    // start after a live server, so every dead run is carried to the
+    // live server that follows it, and that server comes last
+    MapIterator first = skip_dead(cache_indices_.begin());
+    MapIterator m = first;
+    long long carried = 0;
+    do {
+      ++m;
+      if (m == cache_indices_.end()) {
+        m = cache_indices_.begin();
+      }
+      if (dead_.find(m->first) != dead_.end()) {
+        carried += m->second.size();
+      }
+      else {
+        f(m->first, m->second.size() + carried);
+        carried = 0;
+      }
+    } while (m != first);
+  }
+
+  /**
+   * @brief Erases a dead server from the ring once all of its keys have left
+   */
+  void compact_dead(server_id s) {
+    MapIterator m = cache_indices_.find(s);
+    if (m != cache_indices_.end() && m->second.empty() &&
+        dead_.erase(s)) {
+      erase_position(m);
+    }
+  }
+
+  /**
+   * @brief Finishes a lookup whose natural server is dead. If the key is still
+   *    sitting on one of the dead servers it passed, it is moved to the live one.
+   * @param key the key being looked up
+   * @param m the dead server the key hashed to
+   * @returns iterator to the live server that owns the key
+   */
+  MapIterator lookup_past_dead(long long key, MapIterator m) {
+    MapIterator live = skip_dead(m);
+    std::vector<server_id> passed;
+    while (m != live) {
+      if (m->second.erase_key(key)) {
+        live->second.push_back(key);
+        count_load(m->second.size() + 1, m->second.size());
+        count_load(live->second.size() - 1, live->second.size());
+        note_overflow(live);
+        if (migrations_) {
+          migrations_->emit(key, side_, m->first, side_, live->first);
+        }
+      }
+      passed.push_back(m->first);
+      ++m;
+      if (m == cache_indices_.end()) {
+        m = cache_indices_.begin();
+      }
+    }
+    for (const auto& d : passed) {
+      compact_dead(d);
+    }
+    return live;
+  }
+
+  /**
+   * @brief Copies the live server positions out to the NUMA replicas, if
+   *    there are any and the live servers have changed since the last copy.
+   *    A few changes only copy the blocks they fall in; when they would
+   *    touch most blocks anyway every replica is rebuilt.
+   * @param full whether to rebuild every replica, for a fresh set of them
+   */
+  void publish_replicas(bool full = false) {
+    if (!replicas_ || (!full && replicas_->version() == generation_)) {
+      return;
+    }
+    std::vector<std::pair<long long, int> > changes(replica_changes_.begin(), replica_changes_.end());
+    replica_changes_.clear();
+    if (!full && changes.size() * REPLICA_BLOCK < live_.size() &&
+        replicas_->update(changes, replicas_->version(), generation_)) {
+      return;
+    }
+    std::vector<long long> live;
+    live.reserve(cache_indices_.size() - dead_.size());
+    for (const auto& x : cache_indices_) {
+      if (dead_.find(x.first) == dead_.end()) {
+        live.push_back(x.first);
+      }
+    }
+    replicas_->publish(live, generation_, kss_, hash);
+  }
+
+  /**
+   * @brief Finds the servers of up to LOOKUP_GROUP keys together. Each step
+   *    prefetches what every key needs next before any key reads what the
+   *    step before prefetched, so the cache misses of the group overlap.
+   *    The index has to be on and no server can be dead.
+   * @param buckets whether to also prefetch each server's bucket
+   */
+  void find_servers(const long long* keys, size_t n, MapIterator* out, bool buckets) {
+    unsigned long long pos[LOOKUP_GROUP];
+    const IndexSlot* slots[LOOKUP_GROUP];
+    for (size_t i = 0; i < n; ++i) {
+      pos[i] = hash(keys[i], kss_);
+      slots[i] = &index_[slot_of(pos[i])];
+      __builtin_prefetch(slots[i]);
+    }
+    for (size_t i = 0; i < n; ++i) {
+      out[i] = slots[i]->it;
+      if (out[i] != cache_indices_.end()) {
+        const char* node = (const char*) &*out[i];
+        __builtin_prefetch(node);
+        if (buckets) {
+          __builtin_prefetch(node + 64);
+          __builtin_prefetch(node + 128);
+        }
+      }
+    }
+    for (size_t i = 0; i < n; ++i) {
+      MapIterator m = out[i];
+      if (slots[i]->pos < pos[i]) {
+        while (m != cache_indices_.end() && m->first < pos[i]) {
+          ++m;
+        }
+      }
+      out[i] = m == cache_indices_.end() ? cache_indices_.begin() : m;
+    }
+  }
 public:
   friend class CuckooRings;
+  friend class VersionedRing;
+  friend class DomainRings;
  /**
    * Constructor for the RingHash function.
    * @param key_space_size coreesponds to the maximum server id
    * @param init_servers number of servers to initialize the ring with
    */
   RingHash(long long key_space_size, int init_servers) :
-      kss_(key_space_size), num_servers_(init_servers) {
+      kss_(key_space_size), num_servers_(init_servers),
+      migrations_(NULL), side_(0), collect_overflow_(false), load_squares_(0),
+      servers_added_(0), servers_removed_(0), index_scale_(0), generation_(1), replicas_(NULL),
+      rng_(((uint64_t) rand() << 32) ^ rand()) {
     num_keys_ = 0;
     // Give the RingHash the default hash function.
     hash = hashstd;
     // Set up keyspace now
+    live_slot_.reserve(init_servers);
     for (int i = 0; i < init_servers; ++i) {
-      cache_indices_.insert(std::make_pair( (long long) (i* (((double)key_space_size)/init_servers)),
-          std::vector<int>()));
+      long long pos = (unsigned __int128) i * key_space_size / init_servers;
+      if (cache_indices_.insert(std::make_pair(pos, Bucket())).second) {
+        track_live(pos);
+      }
     }
+    load_counts_.assign(1, cache_indices_.size());
   }
 
   /**
@@ -92,16 +595,41 @@ public:
    */
   RingHash(long long key_space_size, long long init_servers,
       std::function<long long(long long, long long)> hashfn) :
-      kss_(key_space_size), num_servers_(init_servers) {
+      kss_(key_space_size), num_servers_(init_servers),
+      migrations_(NULL), side_(0), collect_overflow_(false), load_squares_(0),
+      servers_added_(0), servers_removed_(0), index_scale_(0), generation_(1), replicas_(NULL),
+      rng_(((uint64_t) rand() << 32) ^ rand()) {
     num_keys_ = 0;
     // Set up keyspace now
+    live_slot_.reserve(init_servers);
     for (int i = 0; i < init_servers; ++i) {
-      cache_indices_.insert(std::make_pair( (long long) (i* (((double)key_space_size)/init_servers)),
-          std::vector<int>()));
+      long long pos = (unsigned __int128) i * key_space_size / init_servers;
+      if (cache_indices_.insert(std::make_pair(pos, Bucket())).second) {
+        track_live(pos);
+      }
     }
+    load_counts_.assign(1, cache_indices_.size());
     hash = hashfn;
   }
 
+  /**
+   * Copy constructor. The copy gets its own lookup index over its own map,
+   * and is not hooked up to the original's MigrationTracker or NUMA replicas.
+   */
+  RingHash(const RingHash& other) {
+    copy_from(other);
+  }
+
+  /**
+   * Copy assignment, with the same rules as the copy constructor
+   */
+  RingHash& operator=(const RingHash& other) {
+    if (this != &other) {
+      copy_from(other);
+    }
+    return *this;
+  }
+
   /**
    * Destructor
    */
@@ -112,7 +640,7 @@ public:
    * @returns int indicating how many servers there are
    */
   int size (void) {
-    return cache_indices_.size();
+    return cache_indices_.size() - dead_.size();
   }
 
 
@@ -126,15 +654,59 @@ public:
    */
    // return -1 if insertion is fine, serverid otherwise
   server_id insert (int key) {
-    ++num_keys_;
-    server_id tmp = lookup(key);
-    cache_indices_[tmp].push_back(key); 
-    if (cache_indices_[tmp].size() > SERVER_THRESHOLD) {
-      return tmp;
+    return insert_at(find_server(key), key);
+  }
+
+  /**
+   * @brief Inserts many keys in one pass around the ring. The keys are
+   *    sorted by position and each one's server is found by stepping on
+   *    from the last one's, so buckets are filled in ring order instead of
+   *    at random. A search is only done when the next server is more than
+   *    a few steps away.
+   * @param keys the keys to insert; keys already stored are skipped
+   * @returns the servers left holding more than SERVER_THRESHOLD keys
+   */
+  std::vector<server_id> insert_batch(const std::vector<int>& keys) {
+    std::vector<server_id> over;
+    if (keys.empty() || cache_indices_.empty()) {
+      return over;
+    }
+    // finding a server past a dead one can erase it, so go one key at a time
+    if (!dead_.empty()) {
+      for (const auto& key : keys) {
+        server_id s = insert(key);
+        if (s != -1) {
+          over.push_back(s);
+        }
+      }
     }
     else {
-      return -1;
+      std::vector<std::pair<unsigned long long, int> > sorted(keys.size());
+      for (size_t i = 0; i < keys.size(); ++i) {
+        sorted[i] = std::make_pair(hash(keys[i], kss_), keys[i]);
+      }
+      std::sort(sorted.begin(), sorted.end());
+      // walking only pays when the keys are about as dense as the servers
+      size_t walk = 8 * sorted.size() >= cache_indices_.size() ? 8 : 0;
+      MapIterator m = cache_indices_.lower_bound(sorted[0].first);
+      for (const auto& k : sorted) {
+        size_t steps = 0;
+        while (m != cache_indices_.end() && m->first < k.first && ++steps <= walk) {
+          ++m;
+        }
+        if (steps > walk) {
+          m = cache_indices_.lower_bound(k.first);
+        }
+        // keys past the last server belong to the first
+        MapIterator owner = m == cache_indices_.end() ? cache_indices_.begin() : m;
+        if (insert_at(owner, k.second) != -1 && (over.empty() || over.back() != (server_id) owner->first)) {
+          over.push_back(owner->first);
+        }
+      }
     }
+    std::sort(over.begin(), over.end());
+    over.erase(std::unique(over.begin(), over.end()), over.end());
+    return over;
   }
 
   /**
@@ -142,20 +714,17 @@ public:
    * @brief removes a key into the HashRing
    */
   void remove(long long key) {
+    remove_at(find_server(key), key);
+  }
 
-    server_id tmp = lookup(key);
-    VectorIterator it;
-
-    std::vector<int> vals = cache_indices_[tmp];
-
-    // iterate over the vector and remove the given key
-    for (it=cache_indices_[tmp].begin(); it != cache_indices_[tmp].end(); ++it){
-      if (*it == key) {
-        cache_indices_[tmp].erase(it);
-        --num_keys_;
-        break;
-      }
-    }
+  /**
+   * #param the key that is being checked
+   * @brief Determines whether a key is in the HashRing. The server's
+   *    fingerprints are checked first, so a miss almost never reads a key.
+   * @returns true if the key is there
+   */
+  bool contains(long long key) {
+    return find_server(key)->second.contains(key);
   }
 
   /**
@@ -164,47 +733,245 @@ public:
    * @returns server_id of the associated server
    */
   server_id lookup (long long key) {
-    long long tmp = hash(key, kss_);
-    MapIterator m = cache_indices_.lower_bound(tmp);
-    if (m == cache_indices_.end()){
-      m = cache_indices_.begin();
+    server_id s;
+    if (!cache_.enabled()) {
+      return find_server(key)->first;
+    }
+    if (cache_.probe(key, generation_, &s)) {
+      return s;
+    }
+    s = find_server(key)->first;
+    cache_.fill(key, generation_, s);
+    return s;
+  }
+
+  /**
+   * #param the key that is being looked up
+   * @brief Finds the r distinct live servers that follow a key on the ring,
+   *    for placing replicas. Only walks the ring once.
+   * @param r the number of servers wanted
+   * @returns vector of server_ids, the first being the one lookup returns.
+   *    It has fewer than r entries if there are fewer than r servers.
+   */
+  std::vector<server_id> lookup_n(long long key, int r) {
+    std::vector<server_id> servers;
+    lookup_n(key, r, servers);
+    return servers;
+  }
 
+  /**
+   * @brief Same as lookup_n above, but appends the servers to out
+   */
+  void lookup_n(long long key, int r, std::vector<server_id>& out) {
+    walk_n(find_server(key), r, out);
+  }
+
+  /**
+   * @brief Appends the r distinct live servers starting at a live server,
+   *    walking the ring once
+   * @param m the first server, as find_server gives it
+   */
+  void walk_n(MapIterator m, int r, std::vector<server_id>& out) {
+    int found = 0;
+    for (size_t i = 0; i < cache_indices_.size() && found < r; ++i) {
+      if (dead_.empty() || dead_.find(m->first) == dead_.end()) {
+        out.push_back(m->first);
+        ++found;
+      }
+      ++m;
+      if (m == cache_indices_.end()) {
+        m = cache_indices_.begin();
+      }
     }
-    return m->first;
+  }
+
+  /**
+   * @brief Finds the replica servers of a batch of keys
+   * @param keys the keys being looked up
+   * @param r the number of servers wanted for each key
+   * @param out the servers are appended here, min(r, size()) for each key in order,
+   *    and none if r is not positive
+   */
+  void lookup_n(const std::vector<long long>& keys, int r, std::vector<server_id>& out) {
+    out.reserve(out.size() + keys.size() * std::min(std::max(r, 0), size()));
+    for (const auto& key : keys) {
+      lookup_n(key, r, out);
+    }
+  }
+
+  /**
+   * @brief Finds the servers of many keys, LOOKUP_GROUP at a time, with the
+   *    memory accesses of the keys in a group overlapped by prefetching.
+   *    Without the lookup index, or with dead servers on the ring, this is
+   *    one lookup after another.
+   * @param out filled with the server of each key, in order
+   */
+  void lookup_batch(const std::vector<long long>& keys, std::vector<server_id>& out) {
+    out.resize(keys.size());
+    if (index_.empty() || !dead_.empty() || cache_indices_.empty()) {
+      for (size_t i = 0; i < keys.size(); ++i) {
+        out[i] = lookup(keys[i]);
+      }
+      return;
+    }
+    MapIterator found[LOOKUP_GROUP];
+    for (size_t base = 0; base < keys.size(); base += LOOKUP_GROUP) {
+      size_t n = std::min((size_t) LOOKUP_GROUP, keys.size() - base);
+      find_servers(&keys[base], n, found, false);
+      for (size_t i = 0; i < n; ++i) {
+        out[base + i] = found[i]->first;
+      }
+    }
+  }
+
+  /**
+   * #param the key that is being looked up
+   * @brief Finds every server that currently owns a key. While the key is
+   *    being migrated, this is its new owner followed by its old one. A key
+   *    moving in from the other ring of a CuckooRings only has its old owner
+   *    reported by CuckooRings::lookup_owners.
+   * @returns vector of server_ids, the first being the one lookup returns
+   */
+  std::vector<server_id> lookup_owners(long long key) {
+    std::vector<server_id> owners(1, lookup(key));
+    Migration m;
+    if (migrations_ && migrations_->in_flight(key, &m) &&
+        m.from_side == side_ && m.from != owners[0]) {
+      owners.push_back(m.from);
+    }
+    return owners;
+  }
+
+  /**
+   * @brief Turns on the direct-mapped lookup index, which is kept up to date
+   *    by add_server and remove_server from then on
+   * @param slots the number of slots, or 0 for one per server
+   */
+  void enable_lookup_index(size_t slots = 0) {
+    build_index(slots ? slots : std::max((size_t) 1, cache_indices_.size()));
+  }
+
+  /**
+   * @brief Turns the lookup index off and frees it
+   */
+  void disable_lookup_index(void) {
+    std::vector<IndexSlot>().swap(index_);
+  }
+
+  /**
+   * @brief Puts a direct-mapped cache of key to server_id in front of lookup.
+   *    Every membership change drops all of its entries.
+   * @param entries the number of entries, or 0 to turn the cache off
+   */
+  void enable_lookup_cache(size_t entries) {
+    cache_ = entries ? LookupCache<server_id>(entries) : LookupCache<server_id>();
+  }
+
+  /**
+   * @brief the number of lookups answered by the cache
+   */
+  long long lookup_cache_hits(void) {
+    return cache_.hits();
+  }
+
+  /**
+   * @brief the number of lookups the cache could not answer
+   */
+  long long lookup_cache_misses(void) {
+    return cache_.misses();
+  }
+
+  /**
+   * @brief A number that changes whenever lookup could start giving a
+   *    different answer for some key
+   */
+  unsigned long long generation(void) {
+    return generation_;
+  }
+
+  /**
+   * @brief Reports every key moved by membership changes to a MigrationTracker
+   *    instead of treating the move as instantaneous
+   * @param tracker the tracker to report to, or NULL to turn this off
+   * @param side the side reported in the events
+   */
+  void set_migration_tracker(MigrationTracker* tracker, int side = 0) {
+    migrations_ = tracker;
+    side_ = side;
+  }
+
+  /**
+   * @brief Keeps a copy of the server positions on every NUMA node, for
+   *    lookup_local. Every membership change updates the copies, copying
+   *    only the blocks of positions it touches.
+   * @param replicas the replicas to publish to, or NULL to turn this off
+   */
+  void set_numa_replicas(NumaReplicas* replicas) {
+    replicas_ = replicas;
+    replica_changes_.clear();
+    publish_replicas(true);
+  }
+
+  /**
+   * #param the key that is being looked up
+   * @brief Finds the server associated with a key using the replica on the
+   *    calling thread's NUMA node. Unlike lookup, it is safe to call from
+   *    other threads while this one changes the membership. Without
+   *    set_numa_replicas it falls back to lookup, which is not.
+   * @returns server_id of the associated server
+   */
+  server_id lookup_local(long long key) {
+    return replicas_ ? replicas_->lookup_local(key) : lookup(key);
   }
 
 
   /**
    * #param location where server will be put
-   * @brief adds a server to the RingHash
+   * @brief adds a server to the RingHash. A location outside [0, kss) or
+   *    one that already has a server is ignored.
    * @returns void
    */
-  void add_server(int server_loc) {
-    
-    VectorIterator it;
-    MapIterator m = cache_indices_.lower_bound(server_loc);
-    if (m == cache_indices_.end()){
-      m = cache_indices_.begin();
+  void add_server(long long server_loc) {
+    if (server_loc < 0 || server_loc >= kss_ ||
+        cache_indices_.find(server_loc) != cache_indices_.end()) {
+      return;
     }
-    server_id server_to_bump = m->first;
-    // note that this works since we are putting the
-    // new server at the location of its hash
 
-    // make a copy of the set
-    std::vector<int> keys_to_bump(cache_indices_[server_to_bump]);
+    VectorIterator it;
+    MapIterator m = successor(server_loc);
+    // note that this works since we are putting the
+    // new server at the location of its hash.
+    // Any dead servers in the way are bumped along with the first live one.
+    std::vector<server_id> servers_to_bump(1, m->first);
+    std::vector<Bucket> keys_to_bump;
+    MapIterator live = skip_dead(m);
+    while (m != live) {
+      ++m;
+      if (m == cache_indices_.end()) {
+        m = cache_indices_.begin();
+      }
+      servers_to_bump.push_back(m->first);
+    }
 
-    // clear the original one
-    cache_indices_[server_to_bump].clear();
+    // take the keys, leaving the originals empty
+    for (const auto& server_to_bump : servers_to_bump) {
+      keys_to_bump.push_back(std::move(cache_indices_[server_to_bump]));
+      count_load(keys_to_bump.back().size(), 0);
+    }
 
     // add the new server
-    cache_indices_.insert(std::make_pair(server_loc, std::vector<int>()));
+    add_position(server_loc);
     ++num_servers_;
 
     // rehash the keys
-    for (it=keys_to_bump.begin(); it != keys_to_bump.end(); ++it){
-      insert(*it);
+    for (size_t i = 0; i < servers_to_bump.size(); ++i) {
+      for (it=keys_to_bump[i].begin(); it != keys_to_bump[i].end(); ++it){
+        insert(*it);
+      }
+      emit_migrations(keys_to_bump[i], servers_to_bump[i]);
+      compact_dead(servers_to_bump[i]);
     }
-
+    publish_replicas();
 
   }
   /**
@@ -215,20 +982,112 @@ public:
   void remove_server(server_id s) {
 
     VectorIterator it;
+    MapIterator gone = cache_indices_.find(s);
+    if (gone == cache_indices_.end()) {
+      return;
+    }
+
+    // a dead server was already taken out of the count
+    if (dead_.erase(s)) {
+      ++num_servers_;
+    }
 
-    // make a copy of the keys in the server that will be removed
-    std::vector<int> keys_to_bump(cache_indices_[s]);
+    // take the keys of the server that will be removed
+    Bucket keys_to_bump(std::move(gone->second));
+    count_load(keys_to_bump.size(), 0);
 
     // remove the given server
-    cache_indices_.erase(s);
+    erase_position(gone);
 
     // rehash the keys
     for (it=keys_to_bump.begin(); it != keys_to_bump.end(); ++it){
       insert(*it);
     }
+    emit_migrations(keys_to_bump, s);
+
+    --num_servers_;
+    publish_replicas();
+
+  }
 
+  /**
+   * #param the server_id of the server being removed
+   * @brief Marks a server as dead without moving any of its keys. Lookups
+   *    skip it from now on, and its keys move to the next live server when
+   *    they are next looked up or when sweep reaches them.
+   * @returns void
+   */
+  void remove_server_lazy(server_id s) {
+    if (cache_indices_.find(s) == cache_indices_.end() || !dead_.insert(s).second) {
+      return;
+    }
+    untrack_live(s);
     --num_servers_;
+    ++generation_;
+    compact_dead(s);
+    publish_replicas();
+  }
+
+  /**
+   * @brief Moves keys off of dead servers, erasing each one once it is empty.
+   *    Like a lookup that moves a key, it does not cuckoo a server the keys
+   *    push over SERVER_THRESHOLD; CuckooRings relieves those itself.
+   * @param max_keys the most keys to move in this call, so that the caller
+   *    can spread the work out over time
+   * @returns the number of keys moved
+   */
+  long long sweep(long long max_keys) {
+    long long moved = 0;
+    while (moved < max_keys && !dead_.empty()) {
+      server_id s = *dead_.begin();
+      Bucket& keys = cache_indices_[s];
+      while (moved < max_keys && !keys.empty()) {
+        int key = keys.back();
+        // the key's owner is its first live server, which need not be the one after s
+        MapIterator m = skip_dead(successor(hash(key, kss_)));
+        if (dead_.find(m->first) != dead_.end()) {
+          // every server is dead, so there is nowhere to put the key
+          return moved;
+        }
+        keys.pop_back();
+        count_load(keys.size() + 1, keys.size());
+        m->second.push_back(key);
+        count_load(m->second.size() - 1, m->second.size());
+        note_overflow(m);
+        if (migrations_) {
+          migrations_->emit(key, side_, s, side_, m->first);
+        }
+        ++moved;
+      }
+      if (keys.empty()) {
+        compact_dead(s);
+      }
+    }
+    return moved;
+  }
 
+  /**
+   * @brief the number of dead servers that still hold keys
+   */
+  int num_dead_servers(void) {
+    return dead_.size();
+  }
+
+  /**
+   * @brief Reports the keys that just left a server to the MigrationTracker
+   * @param keys the keys that were rehashed
+   * @param from the server they were on
+   */
+  void emit_migrations(const Bucket& keys, server_id from) {
+    if (!migrations_) {
+      return;
+    }
+    for (const auto& key : keys) {
+      server_id to = lookup(key);
+      if (to != from) {
+        migrations_->emit(key, side_, from, side_, to);
+      }
+    }
   }
     
   /**
@@ -236,23 +1095,137 @@ public:
    * @returns void
    */
   void clear_server(server_id s) {
-    cache_indices_[s].clear();
+    Bucket& keys = cache_indices_[s];
+    count_load(keys.size(), 0);
+    keys.clear();
+    // an emptied server rarely fills past the inline keys again
+    keys.shrink_to_fit();
     return;
   }
 
+  /**
+   * @brief Applies a burst of server additions and removals in a single
+   *    rebalance pass. The final ring layout is built first, and only then
+   *    are the displaced keys rehashed, so each key moves at most once.
+   * @param adds locations of the servers to be added. Locations outside
+   *    [0, kss) are ignored, as are ones that already have a server.
+   * @param removes server_ids of the servers to be removed
+   * @returns vector of server_ids left holding more than SERVER_THRESHOLD keys
+   */
+  std::vector<server_id> apply_membership_changes(const std::vector<long long>& adds,
+      const std::vector<server_id>& removes) {
+    std::vector<int> keys_to_bump;
+    std::vector<server_id> bumped_from;
+    std::set<unsigned long long> added;
+    std::set<server_id> survivors;
+    std::set<server_id> dead_survivors;
+    std::set<server_id> overloaded;
+
+    // take the keys out of every server that is going away
+    for (const auto& s : removes) {
+      MapIterator m = cache_indices_.find(s);
+      if (m == cache_indices_.end()) {
+        continue;
+      }
+      if (dead_.erase(s)) {
+        ++num_servers_;
+      }
+      keys_to_bump.insert(keys_to_bump.end(), m->second.begin(), m->second.end());
+      bumped_from.resize(keys_to_bump.size(), s);
+      erase_position(m);
+      --num_servers_;
+    }
+
+    // put the new servers on the ring
+    for (const auto& loc : adds) {
+      if (loc >= 0 && loc < kss_ && add_position(loc)) {
+        added.insert(loc);
+        ++num_servers_;
+      }
+    }
+
+    // a new server only takes keys from the first live old server after it,
+    // and from any dead servers along the way
+    for (const auto& loc : added) {
+      MapIterator m = cache_indices_.upper_bound(loc);
+      for (size_t i = 0; i < cache_indices_.size(); ++i) {
+        if (m == cache_indices_.end()) {
+          m = cache_indices_.begin();
+        }
+        if (dead_.find(m->first) != dead_.end()) {
+          dead_survivors.insert(m->first);
+        }
+        else if (added.find(m->first) == added.end()) {
+          survivors.insert(m->first);
+          break;
+        }
+        ++m;
+      }
+    }
+
+    // dead servers give up all of their keys
+    for (const auto& s : dead_survivors) {
+      Bucket& keys = cache_indices_[s];
+      keys_to_bump.insert(keys_to_bump.end(), keys.begin(), keys.end());
+      bumped_from.resize(keys_to_bump.size(), s);
+      count_load(keys.size(), 0);
+      keys.clear();
+    }
+
+    // keep the keys that still belong to their survivor, bump the rest
+    for (const auto& s : survivors) {
+      Bucket& keys = cache_indices_[s];
+      size_t kept = 0;
+      for (size_t i = 0; i < keys.size(); ++i) {
+        if (lookup(keys[i]) == s) {
+          keys.set(kept++, keys[i]);
+        }
+        else {
+          keys_to_bump.push_back(keys[i]);
+          bumped_from.push_back(s);
+        }
+      }
+      count_load(keys.size(), kept);
+      keys.resize(kept);
+    }
+
+    // every displaced key goes straight to its final server
+    for (size_t i = 0; i < keys_to_bump.size(); ++i) {
+      server_id tmp = lookup(keys_to_bump[i]);
+      Bucket& keys = cache_indices_[tmp];
+      keys.push_back(keys_to_bump[i]);
+      count_load(keys.size() - 1, keys.size());
+      if (keys.size() > SERVER_THRESHOLD) {
+        overloaded.insert(tmp);
+      }
+      if (migrations_ && tmp != bumped_from[i]) {
+        migrations_->emit(keys_to_bump[i], side_, bumped_from[i], side_, tmp);
+      }
+    }
+    for (const auto& s : dead_survivors) {
+      compact_dead(s);
+    }
+    publish_replicas();
+
+    return std::vector<server_id>(overloaded.begin(), overloaded.end());
+  }
+
   // For usage in CuckooRings
   // @Deprecated
   void remove_server_no_rehash(server_id s) {
-
-    VectorIterator it;
-
-    // make a copy of the keys in the server that will be removed
-    std::vector<int> keys_to_bump(cache_indices_[s]);
+    MapIterator gone = cache_indices_.find(s);
+    if (gone == cache_indices_.end()) {
+      return;
+    }
 
     // remove the given server
-    cache_indices_.erase(s);
+    erase_position(gone);
+    if (dead_.erase(s)) {
+      ++num_servers_;
+    }
 
     --num_servers_;
+    publish_replicas();
   }
 
   /**
@@ -268,47 +1241,161 @@ public:
     cout << "Total load is " << total << endl; 
   }
 
+  /**
+   * @brief Adds the health of the ring to a set of metrics: the load
+   *    histogram and what follows from it, the keys and servers, and the
+   *    membership changes so far. Loads are of the keys each server holds,
+   *    dead servers included, where cost_of_structure counts a dead server's
+   *    keys on the live server they go to. It reads only running totals, so
+   *    it costs O(max load) however many servers there are.
+   * @param out the metrics to add to
+   * @param labels labels telling this ring apart from others in out
+   */
+  void metrics(Metrics& out, const Metrics::Labels& labels) {
+    size_t top = load_counts_.size();
+    while (top > 0 && load_counts_[top - 1] == 0) {
+      --top;
+    }
+    size_t bottom = 0;
+    while (bottom < top && load_counts_[bottom] == 0) {
+      ++bottom;
+    }
+    std::vector<long long> counts(load_counts_.begin(), load_counts_.begin() + top);
+    long long keys = 0;
+    for (size_t l = 0; l < top; ++l) {
+      keys += counts[l] * (long long) l;
+    }
+    double n = cache_indices_.size();
+    double mean = n > 0 ? keys / n : 0;
+    double variance = n > 0 ? load_squares_ / n - mean * mean : 0;
+
+    out.gauge("ring_servers", "Live servers on the ring", labels, live_.size());
+    out.gauge("ring_dead_servers", "Servers removed lazily that still hold keys",
+        labels, dead_.size());
+    out.gauge("ring_keys", "Keys stored on the ring", labels, keys);
+    out.gauge("ring_load_max", "Most keys on any server", labels, top > 0 ? top - 1 : 0);
+    out.gauge("ring_load_min", "Fewest keys on any server", labels, bottom < top ? bottom : 0);
+    out.gauge("ring_load_mean", "Mean keys per server", labels, mean);
+    out.gauge("ring_load_variance", "Variance of the keys per server", labels, variance);
+    out.gauge("ring_cost", "Sum of the squared server loads, as cost_of_structure counts it",
+        labels, load_squares_);
+    out.histogram("ring_server_load", "Servers by the number of keys they hold", labels, counts);
+    out.counter("ring_servers_added_total", "Servers added since the ring was built",
+        labels, servers_added_);
+    out.counter("ring_servers_removed_total", "Servers removed since the ring was built",
+        labels, servers_removed_);
+    out.counter("ring_generation", "Changes to the set of live servers, starting from 1",
+        labels, generation_);
+  }
+
+  /**
+   * @brief Breaks down the memory the ring uses by component: the ring
+   *    object itself, the map nodes apart from the buckets in them, the
+   *    buckets, their overflow chunks, the dead set, the live list, the
+   *    load histogram, the lookup index and the lookup cache. NUMA replicas
+   *    belong to whoever made them and are not counted.
+   */
+  MemoryUsage memory_usage(void) {
+    MemoryUsage m;
+    size_t spill = 0;
+    for (const auto& x : cache_indices_) {
+      if (x.second.spilled()) {
+        spill += MemoryUsage::heap_block(x.second.spill_bytes());
+      }
+      m.slack += (x.second.capacity() - x.second.size()) * (sizeof(int) + 1);
+      m.keys += x.second.size();
+    }
+    m.servers = size();
+    m.add("object", sizeof(*this));
+    m.add("ring_nodes", MemoryUsage::tree_nodes(cache_indices_.size(), sizeof(MapType::value_type))
+        - cache_indices_.size() * sizeof(Bucket));
+    m.add("buckets", cache_indices_.size() * sizeof(Bucket));
+    m.add("bucket_spill", spill);
+    m.add("dead_set", MemoryUsage::tree_nodes(dead_.size(), sizeof(server_id)));
+    m.add("live_list", MemoryUsage::heap_array(live_.capacity() * sizeof(server_id)) +
+        MemoryUsage::hash_table(live_slot_.size(), live_slot_.bucket_count(),
+        sizeof(std::pair<const server_id, size_t>)));
+    m.add("load_histogram", MemoryUsage::heap_array(load_counts_.capacity() * sizeof(long long)));
+    m.add("lookup_index", MemoryUsage::heap_array(index_.capacity() * sizeof(IndexSlot)));
+    m.add("lookup_cache", MemoryUsage::heap_array(cache_.bytes()));
+    return m;
+  }
+
+  /**
+   * @brief Gives back memory the ring holds but doesn't use, and repacks it.
+   *    Overflow chunks shrink to their keys, or go away when the keys fit
+   *    inline again, and the containers give back spare capacity. The map
+   *    is rebuilt in ring order, so its nodes are allocated one after
+   *    another and a walk around the ring reads memory in order. For a
+   *    moment both maps exist. Lookups give the same answers afterwards.
+   * @returns the bytes given back, by memory_usage's count
+   */
+  size_t compact(void) {
+    size_t before = memory_usage().total();
+    {
+      MapType packed;
+      for (MapIterator m = cache_indices_.begin(); m != cache_indices_.end(); ++m) {
+        m->second.shrink_to_fit();
+        packed.emplace_hint(packed.end(), m->first, std::move(m->second));
+      }
+      cache_indices_.swap(packed);
+    }
+    // the index points into the old map
+    if (!index_.empty()) {
+      build_index(index_.size());
+    }
+    index_.shrink_to_fit();
+    live_.shrink_to_fit();
+    live_slot_.rehash(0);
+    while (load_counts_.size() > 1 && load_counts_.back() == 0) {
+      load_counts_.pop_back();
+    }
+    load_counts_.shrink_to_fit();
+    size_t after = memory_usage().total();
+    return before > after ? before - after : 0;
+  }
+
   /**
    * @brief finds the server with the highest load
    * @returns the server id of that server
    */
   server_id get_max_load_server(void){
     server_id highest_server = 0;
-    int sz = 0;
-    for (const auto&x : cache_indices_) {
-      if (x.second.size() > sz) {
-        highest_server = x.first;
-        sz = x.second.size();
+    long long sz = 0;
+    for_each_live_load([&](server_id s, long long load) {
+      if (load > sz) {
+        highest_server = s;
+        sz = load;
       }
-    }
+    });
     return highest_server;
   }
 
   /**
-   * @brief Iterates through the servers and finds the max load
+   * @brief Iterates through the live servers and finds the max load. Keys
+   *    still on dead servers count toward the live server they go to, here
+   *    and in the other load statistics.
    * @returns long long representing the max load
    */
   long long get_max_load(void) {
-    int sz = 0;
-    for (const auto&x : cache_indices_) {
-      if (x.second.size() > sz) {
-        sz = x.second.size();
-      }
-    }
+    long long sz = 0;
+    for_each_live_load([&](server_id s, long long load) {
+      (void) s;
+      sz = std::max(sz, load);
+    });
     return sz;
   }
 
   /**
-   * @brief Iterates through the servers and finds the min load
+   * @brief Iterates through the live servers and finds the min load
    * @returns long long representing the min load
    */
   long long get_min_load(void) {
     long long sz = LLONG_MAX;
-    for (const auto&x : cache_indices_) {
-      if (x.second.size() < sz) {
-        sz = x.second.size();
-      }
-    }
+    for_each_live_load([&](server_id s, long long load) {
+      (void) s;
+      sz = std::min(sz, load);
+    });
     return sz;
   }  
 
@@ -336,9 +1423,10 @@ public:
     float tot = 0;
     float avg = get_avg_load();
     float sz = (float) size();
-    for (const auto&x : cache_indices_) {
-      tot += pow((((float) x.second.size()) - avg), 2.0);
-    }
+    for_each_live_load([&](server_id s, long long load) {
+      (void) s;
+      tot += pow((((float) load) - avg), 2.0);
+    });
     return tot/sz;
 
   }
@@ -350,16 +1438,32 @@ public:
    * @returns void
    */
   void remove_random_server(void){
-    MapIterator m = cache_indices_.lower_bound(rand() % kss_);
-    if (m == cache_indices_.end()){
-      m = cache_indices_.begin();
-    }
-    server_id s =  m->first;
+    server_id s = random_server();
     remove_server(s);
 
     //cout << "random server id to delete: " << s << endl;
   }
 
+  /**
+   * @brief picks a live server uniformly at random, in O(1) and however
+   *    unevenly the servers are spaced on the ring
+   * @returns the server_id of that server, or -1 if there is none
+   */
+  server_id random_server(void) {
+    if (live_.empty()) {
+      return -1;
+    }
+    return live_[fastrange(rng_(), live_.size())];
+  }
+
+  /**
+   * @brief Reseeds the generator behind random_server and add_random_server
+   *    so a run can be repeated exactly
+   */
+  void seed(uint64_t s) {
+    rng_.seed(s);
+  }
+
   // Determines the cost of a particular server based on how many elements are in it
   /**
    * @brief The penalty for a particular bin's load
@@ -375,9 +1479,10 @@ public:
    */ 
   long long cost_of_structure(void){
     long long cost = 0;
-    for (const auto&x : cache_indices_) {
-      cost += costfunction(x.second.size());
-    }
+    for_each_live_load([&](server_id s, long long load) {
+      (void) s;
+      cost += costfunction(load);
+    });
     return cost;
   }
 
@@ -402,7 +1507,7 @@ public:
     for (const auto&x : cache_indices_) {
       tot += 1;
     }
-    return tot;
+    return tot - dead_.size();
   }
 
   /**
@@ -410,22 +1515,24 @@ public:
    * @returns void
    */
   void add_random_server(void){
-    int randnum = 0;
+    long long pos = 0;
 
     // make sure that the server is not already in there.
     do {
-      randnum = rand();
-    } while (cache_indices_.find(randnum) != cache_indices_.end());
+      pos = fastrange(rng_(), kss_);
+    } while (cache_indices_.find(pos) != cache_indices_.end());
 
-    add_server(randnum);
+    add_server(pos);
   }
 
   /**
    * @brief Gets the keys of a particular server
-   * @returns vector<int> of keys
+   * @returns Bucket of keys
    */
-  vector<int>& get_keys(server_id s) {
+  Bucket& get_keys(server_id s) {
     return cache_indices_[s];
   }
 
 };
+
+#endif
@@ -2,6 +2,7 @@
  *  Tests speed benefits of removing a server. 
  *  Begin by adding 1000000 items to 1000000 servers. Then remove 0 to 100000 servers (10%) by increments of 5000
  *  and track the time it takes to do that for CuckooRing and regular Ring.
+ *  The memory each structure uses, before and after compact, goes to stderr.
  * @author Ankit Gupta
  * @author Jonah Kallenbach
  */
@@ -16,6 +17,7 @@
 #include <stdlib.h>
 
 #include "cuckoorings.hpp"
+#include "perfcounters.hpp"
 
 using namespace std;
 
@@ -24,6 +26,7 @@ int main ()
   // initialize variables and seed the random number generator
   clock_t t1, t2, t3;
   srand (time(NULL));
+  PerfCounters perf;
   int i, j;
 
   // repeat the test several times
@@ -37,6 +40,7 @@ int main ()
 
       // begin timing the RingHash
       t1 = clock();
+      perf.start();
 
       // make all of the insertions
       for (i = 1; i <= 1000000; ++i) {
@@ -48,15 +52,21 @@ int main ()
         r.remove_random_server();
       }
 
+      perf.stop();
       t2 = clock();
 
       // print statistics
       cout << ((float)(t2-t1))/CLOCKS_PER_SEC << ",";
       cout << ((float) r.cost_of_structure()) / r.getNumServers() << ",";
       cout << r.get_max_load() << endl;
+      perf.report("RingHash insert and remove", 1000000 + j);
+      r.memory_usage().report("RingHash memory");
+      r.compact();
+      r.memory_usage().report("RingHash memory after compact");
 
       // reset the clock
       t1 = clock();
+      perf.start();
 
       // insert keys into CuckooRings
       for (i = 1; i <= 1000000; ++i) {
@@ -68,12 +78,17 @@ int main ()
         c.remove_random_server(0, 0);
         c.remove_random_server(0, 1);
       }
+      perf.stop();
       t2 = clock();
 
       // print statistics
       cout << ((float)(t2-t1))/CLOCKS_PER_SEC << ",";
       cout << ((float) c.cost_of_structure()) / c.getNumServers() << ",";
       cout << c.get_max_load() << endl;  
+      perf.report("CuckooRings insert and remove", 1000000 + j);
+      c.memory_usage().report("CuckooRings memory");
+      c.compact();
+      c.memory_usage().report("CuckooRings memory after compact");
     }
   }
 
@@ -0,0 +1,169 @@
+/** @class StaticRing
+ * @brief A consistent hashing ring over a fixed list of servers, held in
+ * static arrays that are filled in at compile time. A lookup hashes the key
+ * with the same function as RingHash, jumps to its slot in a direct-mapped
+ * index of the positions, one slot per server, and scans a few positions
+ * from there, all inlined, with nothing to build at startup and no heap.
+ *
+ * A StaticRing is an aggregate, so it can be a constexpr or a static const
+ * initialized in place. make_even_ring builds the even layout a RingHash
+ * starts with in a constant expression, and genstaticring writes a header
+ * with any other list of positions, such as a RingHash's after
+ * add_server. Either way it places every key where that RingHash would.
+ *
+ * @author ankitvgupta
+ * @author jonahkall
+ */
+#ifndef STATICRING_HPP
+#define STATICRING_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hashes.hpp"
+
+typedef long long (*KeyHash)(long long, long long);
+
+template <size_t N, KeyHash Hash = hashstd>
+struct StaticRing {
+  static_assert(N > 0, "a StaticRing needs at least one server");
+
+  /**
+   * The key space size, the scale that maps a position to its index slot,
+   * (pos * scale) >> 64, as RingHash's lookup index does, the server
+   * positions in order, and for each slot the first position in it or
+   * after it
+   */
+  long long kss;
+  unsigned long long scale;
+  long long positions[N];
+  uint32_t index[N];
+
+  /**
+   * @brief the number of servers
+   */
+  static constexpr size_t size(void) {
+    return N;
+  }
+
+  /**
+   * @brief Finds the first server at or after a position, wrapping around
+   * @returns its offset in positions
+   */
+  size_t successor(unsigned long long pos) const {
+    size_t i = index[(size_t) (((unsigned __int128) pos * scale) >> 64)];
+    while (i < N && (unsigned long long) positions[i] < pos) {
+      ++i;
+    }
+    return i == N ? 0 : i;
+  }
+
+  /**
+   * #param the key that is being looked up
+   * @brief Finds the server associated with a key
+   * @returns server_id of the associated server, its position, as RingHash
+   *    gives it
+   */
+  long long lookup(long long key) const {
+    return positions[successor(Hash(key, kss))];
+  }
+
+  /**
+   * #param the key that is being looked up
+   * @brief Finds the offset of a key's server in positions, from 0 to N - 1
+   */
+  size_t server_index(long long key) const {
+    return successor(Hash(key, kss));
+  }
+};
+
+/**
+ * @brief the scale of the index of a ring with a slot per server
+ */
+constexpr unsigned long long static_ring_scale(size_t n, long long kss) {
+  return (unsigned long long) (((unsigned __int128) n << 64) / (unsigned long long) kss);
+}
+
+/**
+ * @brief Fills in the index of a ring from its sorted positions, at run
+ *    time, as genstaticring does before writing them out
+ * @param index filled with n entries
+ */
+inline void build_static_ring_index(const long long* positions, size_t n,
+    unsigned long long scale, uint32_t* index) {
+  size_t i = 0;
+  for (size_t slot = 0; slot < n; ++slot) {
+    while (i < n && (size_t) (((unsigned __int128) positions[i] * scale) >> 64) < slot) {
+      ++i;
+    }
+    index[slot] = i;
+  }
+}
+
+/**
+ * @brief the position of server i of n spread evenly around the ring, as
+ *    the RingHash constructor places them
+ */
+constexpr long long even_position(size_t i, size_t n, long long kss) {
+  return (long long) ((unsigned __int128) i * (unsigned long long) kss / n);
+}
+
+/**
+ * @brief the first of the evenly spread servers in [lo, hi) whose slot is
+ *    at or after a given one, by binary search
+ */
+constexpr uint32_t even_first_in_slot(size_t slot, size_t lo, size_t hi, size_t n, long long kss) {
+  return lo >= hi ? (uint32_t) lo :
+      ((unsigned __int128) even_position((lo + hi) / 2, n, kss) * static_ring_scale(n, kss)) >> 64 < slot ?
+      even_first_in_slot(slot, (lo + hi) / 2 + 1, hi, n, kss) :
+      even_first_in_slot(slot, lo, (lo + hi) / 2, n, kss);
+}
+
+/**
+ * A list of indices 0, 1, ..., N - 1 to expand the arrays of a StaticRing
+ * from, built in halves so that large rings don't nest templates too deep
+ */
+template <size_t... I>
+struct RingIndices {};
+
+template <typename A, typename B>
+struct JoinRingIndices;
+
+template <size_t... A, size_t... B>
+struct JoinRingIndices<RingIndices<A...>, RingIndices<B...> > {
+  typedef RingIndices<A..., (sizeof...(A) + B)...> type;
+};
+
+template <size_t N>
+struct MakeRingIndices {
+  typedef typename JoinRingIndices<typename MakeRingIndices<N / 2>::type,
+      typename MakeRingIndices<N - N / 2>::type>::type type;
+};
+
+template <>
+struct MakeRingIndices<0> {
+  typedef RingIndices<> type;
+};
+
+template <>
+struct MakeRingIndices<1> {
+  typedef RingIndices<0> type;
+};
+
+template <size_t N, KeyHash Hash, size_t... I>
+constexpr StaticRing<N, Hash> make_even_ring(long long kss, RingIndices<I...>) {
+  return StaticRing<N, Hash>{ kss, static_ring_scale(N, kss),
+      { even_position(I, N, kss)... }, { even_first_in_slot(I, 0, N, N, kss)... } };
+}
+
+/**
+ * @brief Builds, in a constant expression, the ring that
+ *    RingHash(kss, N, Hash) starts with
+ * @param kss the key space size, at least N
+ */
+template <size_t N, KeyHash Hash = hashstd>
+constexpr StaticRing<N, Hash> make_even_ring(long long kss) {
+  return make_even_ring<N, Hash>(kss, typename MakeRingIndices<N>::type());
+}
+
+#endif
@@ -0,0 +1,80 @@
+/*
+ *  Tests StaticRing against the RingHash it stands in for.
+ *  Build a StaticRing of SERVERS servers at compile time with make_even_ring, for each
+ *  of the two hashes of CuckooRings, and check that 10000000 random keys land on the
+ *  same server as they do in a RingHash with the same servers. Track the time per
+ *  lookup of the RingHash, of the RingHash with its lookup index on, and of the
+ *  StaticRing.
+ * @author Ankit Gupta
+ * @author Jonah Kallenbach
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <time.h>
+#include <assert.h>
+#include <stdlib.h>
+
+#include "ringhash.hpp"
+#include "staticring.hpp"
+
+using namespace std;
+
+#define KEYS 10000000
+#define SERVERS 1000
+#define KSS (1LL << 32)
+
+constexpr StaticRing<SERVERS> left_ring = make_even_ring<SERVERS>(KSS);
+constexpr StaticRing<SERVERS, hash_wang64> right_ring = make_even_ring<SERVERS, hash_wang64>(KSS);
+
+/**
+ * @brief Times a lookup over the keys
+ * @returns the time per lookup in ns
+ */
+template <typename Lookup>
+double measure(Lookup lookup, const vector<long long>& keys) {
+  volatile long long sink = 0;
+  long long sum = 0;
+  auto start = chrono::steady_clock::now();
+  for (const auto& k : keys) {
+    sum += lookup(k);
+  }
+  double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+  sink = sum;
+  (void) sink;
+  return ns / keys.size();
+}
+
+template <typename Static>
+void compare(const string& name, const Static& ring, KeyHash hash, const vector<long long>& keys) {
+  RingHash dynamic(KSS, SERVERS, hash);
+  for (const auto& k : keys) {
+    assert(ring.lookup(k) == dynamic.lookup(k));
+  }
+  cout << name << ": all " << keys.size() << " keys on the same servers" << endl;
+  cout << "    RingHash: " << measure([&](long long k) { return dynamic.lookup(k); }, keys)
+       << " ns/lookup" << endl;
+  dynamic.enable_lookup_index();
+  cout << "    RingHash with lookup index: "
+       << measure([&](long long k) { return dynamic.lookup(k); }, keys) << " ns/lookup" << endl;
+  cout << "    StaticRing: " << measure([&](long long k) { return ring.lookup(k); }, keys)
+       << " ns/lookup" << endl;
+}
+
+int main ()
+{
+  // initialize variables and seed the random number generator
+  srand (time(NULL));
+  vector<long long> keys;
+  for (int i = 0; i < KEYS; ++i) {
+    keys.push_back(((long long) rand() << 31) ^ rand());
+  }
+
+  compare("hashstd", left_ring, hashstd, keys);
+  compare("hash_wang64", right_ring, hash_wang64, keys);
+  cout << "StaticRing size: " << sizeof(left_ring) << " bytes, built at compile time" << endl;
+
+  return 0;
+}
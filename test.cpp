@@ -37,11 +37,14 @@ int main ()
   }
 
   cout << "    randomly removing 2000 servers" << endl;
-  for (int rem = 0; rem < 2000; ++rem){
-    r.remove_random_server();
+  set<long long> doomed;
+  while (doomed.size() < 2000) {
+    doomed.insert(r.random_server());
   }
+  r.apply_membership_changes(vector<long long>(),
+      vector<long long>(doomed.begin(), doomed.end()));
   cout << "    adding 500,000 to the ring" << endl;
-  for (int i = 1; i < 500000; ++i) {
+  for (int i = 500000; i < 1000000; ++i) {
     r.insert(i);
   }
 
@@ -55,14 +58,16 @@ int main ()
     c.insert(i);
 
   cout << "    randomly removing 2000 servers (1000 from each Ring)" << endl;
-  for (int rem = 0; rem < 1000; ++rem){
-    c.remove_random_server(0, 0);
-  }
-  for (int rem = 0; rem < 1000; ++rem){
-    c.remove_random_server(0, 1);
+  for (int side = 0; side < 2; ++side) {
+    doomed.clear();
+    while (doomed.size() < 1000) {
+      doomed.insert(c.random_server(side));
+    }
+    c.apply_membership_changes(vector<long long>(),
+        vector<long long>(doomed.begin(), doomed.end()), side);
   }
   cout << "    adding 500,000 to the CuckooRings\n" << endl;
-  for (int i = 1; i < 500000; ++i)
+  for (int i = 500000; i < 1000000; ++i)
     c.insert(i);
 
   t3 = clock();
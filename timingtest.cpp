@@ -8,6 +8,7 @@
 #include <stdlib.h>
 
 #include "cuckoorings.hpp"
+#include "perfcounters.hpp"
 
 using namespace std;
 
@@ -15,23 +16,53 @@ int main ()
 {
   clock_t t1, t2, t3;
   srand (time(NULL));
+  PerfCounters perf;
 
   int i, j;
+  // keeps the lookups from being optimized away
+  volatile long long sink = 0;
   for (j = 50000; j <= 1000000; j += 25000) {
     RingHash r((1L << 32), 1000000);
     CuckooRings c((1L << 32), 500000);
     t1 = clock();
+    perf.start();
     for (i = 1; i <= j; ++i) {
       r.insert(i);
     }
+    perf.stop();
     t2 = clock();
     cout << ((float)(t2-t1))/CLOCKS_PER_SEC << endl;
+    perf.report("RingHash insert", j);
+    r.enable_lookup_index();
     t1 = clock();
+    perf.start();
+    for (i = 1; i <= j; ++i) {
+      sink += r.lookup(i);
+    }
+    perf.stop();
+    t2 = clock();
+    cout << ((float)(t2-t1))/CLOCKS_PER_SEC << endl;
+    perf.report("RingHash lookup", j);
+    vector<long long> keys, servers;
+    for (i = 1; i <= j; ++i) {
+      keys.push_back(i);
+    }
+    t1 = clock();
+    perf.start();
+    r.lookup_batch(keys, servers);
+    perf.stop();
+    t2 = clock();
+    cout << ((float)(t2-t1))/CLOCKS_PER_SEC << endl;
+    perf.report("RingHash lookup_batch", j);
+    t1 = clock();
+    perf.start();
     for (i = 1; i <= j; ++i) {
       c.insert(i);
     }
+    perf.stop();
     t2 = clock();
     cout << ((float)(t2-t1))/CLOCKS_PER_SEC << endl;
+    perf.report("CuckooRings insert", j);
   }
 
   return 0;
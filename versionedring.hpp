@@ -0,0 +1,467 @@
+/** @class VersionedRing
+ * @brief A persistent, copy-on-write version of a RingHash. Copying a
+ * VersionedRing is O(1) and shares all of its structure with the original,
+ * and each change only copies the part of the ring it touches, so many
+ * what-if versions of one ring can be kept and queried side by side.
+ *
+ * The ring is stored as a treap keyed on server location. Nodes are never
+ * modified once a version can reach them; a change copies the path from the
+ * root to the node it touches. Each node also keeps totals for its subtree,
+ * so the load statistics of a version are read off of its root.
+ *
+ * @author ankitvgupta
+ * @author jonahkall
+ */
+#ifndef VERSIONEDRING_HPP
+#define VERSIONEDRING_HPP
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <climits>
+
+#include "cuckoorings.hpp"
+
+class VersionedRing {
+private:
+  typedef long long server_id;
+  typedef std::shared_ptr<const std::vector<int> > BucketPtr;
+
+  struct Node;
+  typedef std::shared_ptr<Node> NodePtr;
+
+  struct Node {
+    unsigned long long pos;
+    unsigned long long priority;
+    BucketPtr keys;
+    NodePtr left;
+    NodePtr right;
+
+    // totals over the subtree rooted here
+    long long servers;
+    long long num_keys;
+    long long cost;
+    long long max_load;
+    long long min_load;
+  };
+
+  NodePtr root_;
+  long long kss_;
+  std::function<long long(long long, long long)> hash;
+
+  /**
+   * @brief The treap priority of a server, a fixed mix of its location
+   */
+  static unsigned long long priority_of(unsigned long long pos) {
+    pos += 0x9e3779b97f4a7c15ULL;
+    pos = (pos ^ (pos >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    pos = (pos ^ (pos >> 27)) * 0x94d049bb133111ebULL;
+    return pos ^ (pos >> 31);
+  }
+
+  /**
+   * @brief Recomputes the subtree totals of a node from its children
+   */
+  static void update(Node* n) {
+    long long sz = n->keys->size();
+    n->servers = 1;
+    n->num_keys = sz;
+    n->cost = sz * sz;
+    n->max_load = sz;
+    n->min_load = sz;
+    const Node* children[2] = { n->left.get(), n->right.get() };
+    for (const Node* c : children) {
+      if (c) {
+        n->servers += c->servers;
+        n->num_keys += c->num_keys;
+        n->cost += c->cost;
+        n->max_load = std::max(n->max_load, c->max_load);
+        n->min_load = std::min(n->min_load, c->min_load);
+      }
+    }
+  }
+
+  /**
+   * @brief Makes a new node, which becomes immutable once returned
+   */
+  static NodePtr make(const Node& proto, NodePtr left, NodePtr right) {
+    NodePtr n = std::make_shared<Node>(proto);
+    n->left = left;
+    n->right = right;
+    update(n.get());
+    return n;
+  }
+
+  static NodePtr make(const Node& proto, BucketPtr keys) {
+    NodePtr n = std::make_shared<Node>(proto);
+    n->keys = keys;
+    update(n.get());
+    return n;
+  }
+
+  /**
+   * @brief Splits a treap into the servers before pos and those at or after it
+   */
+  static void split(NodePtr t, unsigned long long pos, NodePtr& lo, NodePtr& hi) {
+    if (!t) {
+      lo = hi = NodePtr();
+      return;
+    }
+    if (t->pos < pos) {
+      NodePtr l, r;
+      split(t->right, pos, l, r);
+      lo = make(*t, t->left, l);
+      hi = r;
+    }
+    else {
+      NodePtr l, r;
+      split(t->left, pos, l, r);
+      lo = l;
+      hi = make(*t, r, t->right);
+    }
+  }
+
+  /**
+   * @brief Joins two treaps where every server in a comes before every one in b
+   */
+  static NodePtr merge(NodePtr a, NodePtr b) {
+    if (!a) {
+      return b;
+    }
+    if (!b) {
+      return a;
+    }
+    if (a->priority > b->priority) {
+      return make(*a, a->left, merge(a->right, b));
+    }
+    return make(*b, merge(a, b->left), b->right);
+  }
+
+  /**
+   * @brief Replaces the keys of the server at pos, copying only the path to it
+   */
+  static NodePtr replace(const NodePtr& t, unsigned long long pos, BucketPtr keys) {
+    if (t->pos == pos) {
+      return make(*t, keys);
+    }
+    if (pos < t->pos) {
+      return make(*t, replace(t->left, pos, keys), t->right);
+    }
+    return make(*t, t->left, replace(t->right, pos, keys));
+  }
+
+  /**
+   * @brief Finds the first server at or after pos, wrapping around the ring
+   */
+  const Node* successor(unsigned long long pos) const {
+    const Node* best = NULL;
+    const Node* n = root_.get();
+    while (n) {
+      if (n->pos >= pos) {
+        best = n;
+        n = n->left.get();
+      }
+      else {
+        n = n->right.get();
+      }
+    }
+    if (!best) {
+      best = root_.get();
+      while (best && best->left) {
+        best = best->left.get();
+      }
+    }
+    return best;
+  }
+
+  const Node* find(unsigned long long pos) const {
+    const Node* n = root_.get();
+    while (n && n->pos != pos) {
+      n = pos < n->pos ? n->left.get() : n->right.get();
+    }
+    return n;
+  }
+
+  /**
+   * @brief Builds a treap from servers already sorted by location, in O(n)
+   */
+  void build(const std::vector<std::pair<unsigned long long, BucketPtr> >& servers) {
+    std::vector<NodePtr> stack;
+    for (const auto& s : servers) {
+      NodePtr n = std::make_shared<Node>();
+      n->pos = s.first;
+      n->priority = priority_of(s.first);
+      n->keys = s.second;
+      NodePtr last;
+      while (!stack.empty() && stack.back()->priority < n->priority) {
+        last = stack.back();
+        stack.pop_back();
+      }
+      n->left = last;
+      if (!stack.empty()) {
+        stack.back()->right = n;
+      }
+      stack.push_back(n);
+    }
+    root_ = stack.empty() ? NodePtr() : stack[0];
+    fix_totals(root_.get());
+  }
+
+  static void fix_totals(Node* n) {
+    if (!n) {
+      return;
+    }
+    fix_totals(n->left.get());
+    fix_totals(n->right.get());
+    update(n);
+  }
+
+public:
+  /**
+   * Constructor for a VersionedRing, taking a copy of a RingHash in O(n).
+   * Keys still on dead servers are moved to their live owners in the copy.
+   * @param ring the ring to copy
+   */
+  VersionedRing(RingHash& ring) : kss_(ring.kss_), hash(ring.hash) {
+    std::vector<std::pair<unsigned long long, BucketPtr> > servers;
+    for (const auto& x : ring.cache_indices_) {
+      servers.push_back(std::make_pair(x.first,
+          std::make_shared<const std::vector<int> >(x.second.begin(), x.second.end())));
+    }
+    build(servers);
+    for (const auto& s : ring.dead_) {
+      remove_server(s);
+    }
+  }
+
+  /**
+   * @brief Takes a snapshot of this version. Changes to either one are not
+   *    seen by the other.
+   * @returns the snapshot, in O(1)
+   */
+  VersionedRing snapshot(void) const {
+    return *this;
+  }
+
+  /**
+   * #param the key that is being looked up
+   * @brief Finds the server associated with a key
+   * @returns server_id of the associated server
+   */
+  server_id lookup(long long key) const {
+    return successor(hash(key, kss_))->pos;
+  }
+
+  /**
+   * #param the key that is being inserted
+   * @brief Inserts a key, copying only its server and the path to it
+   */
+  void insert(int key) {
+    const Node* n = successor(hash(key, kss_));
+    std::shared_ptr<std::vector<int> > keys = std::make_shared<std::vector<int> >(*n->keys);
+    keys->push_back(key);
+    root_ = replace(root_, n->pos, keys);
+  }
+
+  /**
+   * #param the server_id of the server being removed
+   * @brief removes a server from this version, handing its keys to the next server
+   */
+  void remove_server(server_id s) {
+    const Node* gone = find(s);
+    if (!gone || root_->servers == 1) {
+      return;
+    }
+    BucketPtr orphans = gone->keys;
+    NodePtr lo, mid, hi;
+    split(root_, s, lo, hi);
+    split(hi, s + 1, mid, hi);
+    root_ = merge(lo, hi);
+
+    // every key of s falls between its predecessor and s, so they all go to
+    // the server after s
+    if (!orphans->empty()) {
+      const Node* next = successor(s);
+      std::shared_ptr<std::vector<int> > keys = std::make_shared<std::vector<int> >(*next->keys);
+      keys->insert(keys->end(), orphans->begin(), orphans->end());
+      root_ = replace(root_, next->pos, keys);
+    }
+  }
+
+  /**
+   * #param location where server will be put
+   * @brief adds a server to this version, taking its keys from the next
+   *    server. A location outside [0, kss) is ignored, as RingHash does.
+   */
+  void add_server(long long server_loc) {
+    if (server_loc < 0 || server_loc >= kss_ || find(server_loc)) {
+      return;
+    }
+    Node proto;
+    proto.pos = server_loc;
+    proto.priority = priority_of(server_loc);
+    proto.keys = std::make_shared<const std::vector<int> >();
+    NodePtr lo, hi;
+    split(root_, server_loc, lo, hi);
+    root_ = merge(merge(lo, make(proto, NodePtr(), NodePtr())), hi);
+
+    const Node* next = successor(server_loc + 1);
+    if (next->pos == (unsigned long long) server_loc) {
+      return;
+    }
+    std::shared_ptr<std::vector<int> > stay = std::make_shared<std::vector<int> >();
+    std::shared_ptr<std::vector<int> > moved = std::make_shared<std::vector<int> >();
+    for (const auto& key : *next->keys) {
+      (lookup(key) == server_loc ? moved : stay)->push_back(key);
+    }
+    if (!moved->empty()) {
+      unsigned long long next_pos = next->pos;
+      root_ = replace(root_, server_loc, moved);
+      root_ = replace(root_, next_pos, stay);
+    }
+  }
+
+  /**
+   * @brief Gets the keys of a particular server in this version
+   * @returns vector<int> of keys, empty if there is no such server
+   */
+  std::vector<int> get_keys(server_id s) const {
+    const Node* n = find(s);
+    return n ? *n->keys : std::vector<int>();
+  }
+
+  /**
+   * @brief determines the number of servers in this version, in O(1)
+   */
+  long long getNumServers(void) const {
+    return root_ ? root_->servers : 0;
+  }
+
+  /**
+   * @brief determines the number of keys in this version, in O(1)
+   */
+  long long getNumKeys(void) const {
+    return root_ ? root_->num_keys : 0;
+  }
+
+  /**
+   * @brief the highest load on any server, in O(1)
+   */
+  long long get_max_load(void) const {
+    return root_ ? root_->max_load : 0;
+  }
+
+  /**
+   * @brief the lowest load on any server, in O(1)
+   */
+  long long get_min_load(void) const {
+    return root_ ? root_->min_load : LLONG_MAX;
+  }
+
+  /**
+   * @brief The same squared-load cost as RingHash::cost_of_structure, in O(1)
+   */
+  long long cost_of_structure(void) const {
+    return root_ ? root_->cost : 0;
+  }
+
+  /**
+   * @brief Determines the variance of the loads, in O(1)
+   */
+  long long get_variance_load(void) const {
+    if (!root_) {
+      return 0;
+    }
+    float n = (float) root_->servers;
+    float avg = ((float) root_->num_keys) / n;
+    return ((float) root_->cost) / n - avg * avg;
+  }
+};
+
+/** @class VersionedCuckooRings
+ * @brief A persistent, copy-on-write version of a CuckooRings, made of a
+ * VersionedRing for each side.
+ */
+class VersionedCuckooRings {
+private:
+  typedef long long server_id;
+
+  VersionedRing left_ring_;
+  VersionedRing right_ring_;
+
+public:
+  /**
+   * Constructor for a VersionedCuckooRings, taking a copy of both rings in O(n)
+   */
+  VersionedCuckooRings(CuckooRings& rings) :
+      left_ring_(*rings.left_ring_), right_ring_(*rings.right_ring_) {}
+
+  /**
+   * @brief Takes a snapshot of this version, in O(1)
+   */
+  VersionedCuckooRings snapshot(void) const {
+    return *this;
+  }
+
+  /**
+   * @brief Removes a server from the specified side of this version
+   * @param side 0 for the left ring, 1 for the right
+   */
+  void remove_server(server_id s, int side) {
+    (side == 0 ? left_ring_ : right_ring_).remove_server(s);
+  }
+
+  /**
+   * @brief Adds a server to the specified side of this version
+   * @param side 0 for the left ring, 1 for the right
+   */
+  void add_server(long long server_loc, int side) {
+    (side == 0 ? left_ring_ : right_ring_).add_server(server_loc);
+  }
+
+  /**
+   * @brief Gets the ring on the specified side of this version
+   * @param side 0 for the left ring, 1 for the right
+   */
+  VersionedRing& ring(int side) {
+    return side == 0 ? left_ring_ : right_ring_;
+  }
+
+  /**
+   * @brief evaluates the cost of this version as the cost of both rings
+   */
+  long long cost_of_structure(void) const {
+    return left_ring_.cost_of_structure() + right_ring_.cost_of_structure();
+  }
+
+  /**
+   * @brief finds the highest load on either ring
+   */
+  long long get_max_load(void) const {
+    return std::max(left_ring_.get_max_load(), right_ring_.get_max_load());
+  }
+
+  /**
+   * @brief finds the lowest load on either ring
+   */
+  long long get_min_load(void) const {
+    return std::min(left_ring_.get_min_load(), right_ring_.get_min_load());
+  }
+
+  /**
+   * @brief determines the number of servers on both rings
+   */
+  long long getNumServers(void) const {
+    return left_ring_.getNumServers() + right_ring_.getNumServers();
+  }
+
+  /**
+   * @brief finds the number of keys on both rings
+   */
+  long long getNumKeys(void) const {
+    return left_ring_.getNumKeys() + right_ring_.getNumKeys();
+  }
+};
+
+#endif
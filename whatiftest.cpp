@@ -0,0 +1,122 @@
+/*
+ *  Tests the cost of what-if analysis on versioned rings.
+ *  Begin by adding 1000000 items to 1000000 servers. Then evaluate 100 scenarios that
+ *  each drop 50 random servers, once on snapshots of a VersionedRing and once on deep
+ *  copies of the RingHash, and track the time each takes. The first scenario should
+ *  cost the same either way. Last, check that copies of a ring with its lookup index
+ *  on still find every key after the original is gone, and that servers outside the
+ *  key space are not added.
+ * @author Ankit Gupta
+ * @author Jonah Kallenbach
+ */
+
+#include <iostream>
+#include <string>
+#include <set>
+#include <functional>
+#include <map>
+#include <time.h>
+#include <assert.h>
+#include <stdlib.h>
+
+#include "versionedring.hpp"
+
+using namespace std;
+
+int main ()
+{
+  // initialize variables and seed the random number generator
+  clock_t t1, t2;
+  srand (time(NULL));
+  int i, j;
+
+  RingHash r((1L << 32), 1000000);
+  CuckooRings c((1L << 32), 500000);
+  for (i = 1; i <= 1000000; ++i) {
+    r.insert(i);
+    c.insert(i);
+  }
+
+  // pick the servers each scenario drops
+  vector<vector<long long> > scenarios(100);
+  for (auto& s : scenarios) {
+    for (j = 0; j < 50; ++j) {
+      s.push_back(r.random_server());
+    }
+  }
+
+  // evaluate every scenario on a snapshot
+  t1 = clock();
+  VersionedRing base(r);
+  vector<VersionedRing> versions;
+  for (const auto& s : scenarios) {
+    versions.push_back(base.snapshot());
+    for (const auto& server : s) {
+      versions.back().remove_server(server);
+    }
+  }
+  t2 = clock();
+  cout << "Versioned ring, " << scenarios.size() << " scenarios" << endl;
+  cout << "    Time elapsed (sec): " << ((float) (t2 - t1))/CLOCKS_PER_SEC << endl;
+  cout << "    Cost of first scenario: " << versions[0].cost_of_structure() << endl;
+  cout << "    Max load of first scenario: " << versions[0].get_max_load() << endl;
+
+  // evaluate the first few scenarios on deep copies for comparison
+  t1 = clock();
+  long long cost = 0;
+  for (i = 0; i < 5; ++i) {
+    RingHash copy(r);
+    for (const auto& server : scenarios[i]) {
+      copy.remove_server(server);
+    }
+    if (i == 0) {
+      cost = copy.cost_of_structure();
+      // the snapshot and the deep copy dropped the same servers
+      assert(cost == versions[0].cost_of_structure());
+      assert(copy.get_max_load() == versions[0].get_max_load());
+    }
+  }
+  t2 = clock();
+  cout << "Deep copies, 5 scenarios" << endl;
+  cout << "    Time elapsed (sec): " << ((float) (t2 - t1))/CLOCKS_PER_SEC << endl;
+  cout << "    Cost of first scenario: " << cost << endl;
+
+  // the same on CuckooRings, dropping servers from both sides
+  t1 = clock();
+  VersionedCuckooRings cbase(c);
+  long long best = LLONG_MAX;
+  for (i = 0; i < 100; ++i) {
+    VersionedCuckooRings v = cbase.snapshot();
+    for (j = 0; j < 25; ++j) {
+      v.remove_server(c.random_server(0), 0);
+      v.remove_server(c.random_server(1), 1);
+    }
+    best = min(best, v.cost_of_structure());
+  }
+  t2 = clock();
+  cout << "Versioned CuckooRings, 100 scenarios" << endl;
+  cout << "    Time elapsed (sec): " << ((float) (t2 - t1))/CLOCKS_PER_SEC << endl;
+  cout << "    Lowest cost: " << best << endl;
+
+  // copies of a ring with its lookup index on must not look through the
+  // original's index, so destroy the original before using them
+  RingHash* indexed = new RingHash(r);
+  indexed->enable_lookup_index();
+  RingHash copy(*indexed);
+  RingHash assigned((1L << 32), 1);
+  assigned = *indexed;
+  delete indexed;
+  for (i = 1; i <= 1000000; ++i) {
+    assert(copy.lookup(i) == r.lookup(i) && assigned.lookup(i) == r.lookup(i));
+  }
+  cout << "Copies of an indexed ring look up every key as the original did" << endl;
+
+  // positions outside the key space are ignored
+  int servers = copy.size();
+  copy.add_server(-1);
+  copy.add_server(1L << 32);
+  copy.apply_membership_changes(vector<long long>(1, -1), vector<long long>());
+  assert(copy.size() == servers);
+
+  return 0;
+}
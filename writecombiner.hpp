@@ -0,0 +1,261 @@
+/** @class WriteCombiner
+ * @brief Write-combining inserts for a RingHash or a CuckooRings shared by
+ * many threads. Each writing thread appends keys to a buffer of its own,
+ * and a full buffer is merged into the ring with a single insert_batch,
+ * which sorts the keys by position and fills buckets in ring order. The
+ * ring is locked once per merge instead of once per key.
+ *
+ * Reads go through the combiner. With FLUSH_ON_READ every buffer is merged
+ * before a read, so reads see every key inserted before them. With
+ * BOUNDED_STALENESS reads only take the ring's lock, and a flusher thread
+ * merges every buffer at least once per staleness bound, so a read may miss
+ * keys inserted less than that long ago.
+ *
+ * Keys are only taken out of a buffer under the ring's lock, which is
+ * always taken before a buffer's, so a key is never on its way from a
+ * buffer to the ring while a remove or a read holds the ring.
+ *
+ * @author ankitvgupta
+ * @author jonahkall
+ */
+#ifndef WRITECOMBINER_HPP
+#define WRITECOMBINER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+enum ReadMode { FLUSH_ON_READ, BOUNDED_STALENESS };
+
+template <typename Ring>
+class WriteCombiner {
+private:
+  /**
+   * The keys one thread has inserted since its last merge
+   */
+  struct Buffer {
+    std::mutex lock;
+    std::vector<int> keys;
+  };
+
+  Ring& ring_;
+  std::mutex ring_lock_;
+  size_t capacity_;
+  ReadMode mode_;
+  std::chrono::milliseconds staleness_;
+
+  std::mutex buffers_lock_;
+  std::vector<std::unique_ptr<Buffer> > buffers_;
+
+  std::atomic<long long> merges_;
+  std::atomic<long long> merged_keys_;
+
+  bool stopping_;
+  std::mutex stop_lock_;
+  std::condition_variable stop_;
+  std::thread flusher_;
+
+  /**
+   * @brief Takes the keys out of a buffer and merges them into the ring.
+   *    The caller holds ring_lock_.
+   */
+  void drain_locked(Buffer& b) {
+    std::vector<int> keys;
+    {
+      std::lock_guard<std::mutex> guard(b.lock);
+      keys.swap(b.keys);
+      b.keys.reserve(capacity_);
+    }
+    if (keys.empty()) {
+      return;
+    }
+    ring_.insert_batch(keys);
+    ++merges_;
+    merged_keys_ += keys.size();
+  }
+
+  /**
+   * @brief Takes the keys out of a buffer and merges them
+   */
+  void drain(Buffer& b) {
+    std::lock_guard<std::mutex> guard(ring_lock_);
+    drain_locked(b);
+  }
+
+  /**
+   * @brief Merges every buffer into the ring. The caller holds ring_lock_.
+   */
+  void flush_locked(void) {
+    std::vector<Buffer*> all;
+    {
+      std::lock_guard<std::mutex> guard(buffers_lock_);
+      for (const auto& b : buffers_) {
+        all.push_back(b.get());
+      }
+    }
+    for (const auto& b : all) {
+      drain_locked(*b);
+    }
+  }
+
+  /**
+   * @brief Merges every buffer twice per staleness bound, so no key waits
+   *    longer than the bound
+   */
+  void flush_periodically(void) {
+    std::unique_lock<std::mutex> lock(stop_lock_);
+    while (!stop_.wait_for(lock, staleness_ / 2, [this] { return stopping_; })) {
+      lock.unlock();
+      flush();
+      lock.lock();
+    }
+  }
+
+public:
+  /**
+   * A handle for one writing thread. It is used by that thread alone.
+   */
+  class Writer {
+  private:
+    WriteCombiner* owner_;
+    Buffer* buffer_;
+
+  public:
+    Writer(WriteCombiner* owner, Buffer* buffer) : owner_(owner), buffer_(buffer) {}
+
+    /**
+     * #param the key that is being inserted
+     * @brief Buffers a key, merging the buffer into the ring once it is full
+     */
+    void insert(int key) {
+      {
+        std::lock_guard<std::mutex> guard(buffer_->lock);
+        buffer_->keys.push_back(key);
+        if (buffer_->keys.size() < owner_->capacity_) {
+          return;
+        }
+      }
+      // the buffer's lock is let go first, so the ring's can be taken before it
+      owner_->drain(*buffer_);
+    }
+
+    /**
+     * @brief Merges this thread's buffer now
+     */
+    void flush(void) {
+      owner_->drain(*buffer_);
+    }
+  };
+
+  /**
+   * Constructor for WriteCombiner
+   * @param ring the ring to insert into. While the combiner exists, the ring
+   *    should only be used through it.
+   * @param capacity the number of keys a buffer holds before it is merged
+   * @param mode whether reads merge every buffer first or may be stale
+   * @param staleness_ms with BOUNDED_STALENESS, the longest a key waits in a buffer
+   */
+  WriteCombiner(Ring& ring, size_t capacity, ReadMode mode, unsigned staleness_ms = 10) :
+      ring_(ring), capacity_(std::max((size_t) 1, capacity)), mode_(mode),
+      staleness_(std::max(2u, staleness_ms)), merges_(0), merged_keys_(0), stopping_(false) {
+    if (mode_ == BOUNDED_STALENESS) {
+      flusher_ = std::thread(&WriteCombiner::flush_periodically, this);
+    }
+  }
+
+  /**
+   * Destructor, merges whatever is still buffered. No Writer may be used
+   * after this.
+   */
+  ~WriteCombiner() {
+    if (flusher_.joinable()) {
+      {
+        std::lock_guard<std::mutex> guard(stop_lock_);
+        stopping_ = true;
+      }
+      stop_.notify_one();
+      flusher_.join();
+    }
+    flush();
+  }
+
+  /**
+   * @brief Gives a thread its own buffer to insert through
+   */
+  Writer writer(void) {
+    std::lock_guard<std::mutex> guard(buffers_lock_);
+    buffers_.push_back(std::unique_ptr<Buffer>(new Buffer()));
+    buffers_.back()->keys.reserve(capacity_);
+    return Writer(this, buffers_.back().get());
+  }
+
+  /**
+   * @brief Merges every buffer into the ring
+   */
+  void flush(void) {
+    std::lock_guard<std::mutex> guard(ring_lock_);
+    flush_locked();
+  }
+
+  /**
+   * @brief Runs a function on the ring under its lock, after merging every
+   *    buffer with FLUSH_ON_READ
+   * @returns what the function returns
+   */
+  template <typename F>
+  auto read(F f) -> decltype(f(ring_)) {
+    std::lock_guard<std::mutex> guard(ring_lock_);
+    if (mode_ == FLUSH_ON_READ) {
+      flush_locked();
+    }
+    return f(ring_);
+  }
+
+  /**
+   * #param the key that is being checked
+   * @brief Determines whether a key is in the ring
+   */
+  bool contains(int key) {
+    return read([key](Ring& r) { return r.contains(key); });
+  }
+
+  /**
+   * #param the key that is being looked up
+   * @brief Finds the server associated with a key
+   */
+  long long lookup(int key) {
+    return read([key](Ring& r) { return (long long) r.lookup(key); });
+  }
+
+  /**
+   * #param the key that is being removed
+   * @brief Removes a key, merging every buffer first so that an insert of
+   *    the key still waiting in one can't bring it back
+   */
+  void remove(int key) {
+    std::lock_guard<std::mutex> guard(ring_lock_);
+    flush_locked();
+    ring_.remove(key);
+  }
+
+  /**
+   * @brief the number of merges done so far
+   */
+  long long merges(void) const {
+    return merges_;
+  }
+
+  /**
+   * @brief the number of keys merged so far
+   */
+  long long merged_keys(void) const {
+    return merged_keys_;
+  }
+};
+
+#endif